@@ -1,8 +1,9 @@
 #!/bin/sh
-# Kill the64
-until [ `ps | grep -e the64 | wc -l` -eq 1 ]
+# Kill the64 and wait for it to exit
+while pidof the64 > /dev/null
 do
-        killall the64
+	killall the64
+	usleep 20000
 done
 
 mount -o remount,rw /mnt
@@ -32,6 +33,7 @@ AMORA|ARES|SNOWBIRD|amora|ares|snowbird)
 esac
 
 cp /mnt/keyboard2thejoystick /tmp
-/tmp/keyboard2thejoystick &
+# Returns as soon as the virtual joystick exists, then keeps running
+/tmp/keyboard2thejoystick --daemon
 
 the64 &
@@ -9,26 +9,52 @@
  *   Name: "Retro Games LTD THEC64 Joystick"
  *   ID: bustype=0x0003, vendor=0x1c59, product=0x0023, version=0x0110
  *
- * Cross-compile:
- *   arm-linux-gnueabihf-gcc -static -O2 -o keyboard2thejoystick keyboard2thejoystick.c
+ * Cross-compile (or see the Makefile for size, LTO/PGO and host builds):
+ *   arm-linux-gnueabihf-gcc -static -O2 -pthread -o keyboard2thejoystick keyboard2thejoystick.c
+ *
+ * -DK2J_NO_GUIMAP builds the translator alone, without the font,
+ * framebuffer and remap GUI (Ctrl+R and --guimap are then unavailable).
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <errno.h>
 #include <signal.h>
+#include <spawn.h>
 #include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
 #include <linux/fb.h>
 #include <linux/input.h>
 #include <linux/uinput.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+/* Older kernel headers predate the y2038-safe input_event accessors */
+#ifndef input_event_sec
+#define input_event_sec   time.tv_sec
+#define input_event_usec  time.tv_usec
+#endif
 
 /* ================================================================
  * Constants
@@ -37,17 +63,25 @@
 #define MAX_KEYBOARDS     8
 #define MAX_PATH_LEN      512
 #define MAX_NAME_LEN      256
-#define MAX_DIR_ENTRIES   256
+#define KBD_NODE_LEN      16   /* "event123" */
 #define NUM_DIRECTIONS    8
 #define NUM_BUTTONS       8
 #define NUM_MAPPINGS      16  /* 8 directions + 8 buttons */
+#define MAX_LOOP_FDS      16
+#define MAX_FRAME_EVENTS  64
+#define MAX_PLAYERS       4
+#define MAX_MACROS        16
+#define LAT_BUCKETS       128
 
 #define FONT_W            8
 #define FONT_H            16
 
-#define FRAME_MS          16
+#define MAX_DAMAGE        8
 #define BLINK_MS          400
 #define DEBOUNCE_MS       200
+#define DEVNODE_WAIT_MS   1000  /* upper bound for our /dev node to appear */
+#define THE64_STOP_MS     2000  /* upper bound for the64 to exit */
+#define MAX_THE64_PIDS    8
 
 #define BITS_PER_LONG     (sizeof(long) * 8)
 #define NBITS(x)          ((((x) - 1) / BITS_PER_LONG) + 1)
@@ -86,6 +120,8 @@
 #define COL_SUCCESS       0xFF44FF88
 #define COL_HEADER_BG     0xFF182040
 
+#ifndef K2J_NO_GUIMAP
+
 /* ================================================================
  * Built-in 8x16 VGA bitmap font (printable ASCII 0x20..0x7E)
  * ================================================================ */
@@ -188,6 +224,8 @@ static const uint8_t font8x16[95][16] = {
     /* 0x7E '~' */ {0x00,0x00,0x76,0xDC,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
 };
 
+#endif /* K2J_NO_GUIMAP */
+
 /* ================================================================
  * Key name table
  * ================================================================ */
@@ -322,55 +360,249 @@ typedef struct {
     int         default_key; /* default KEY_* code */
     int         btn_code;    /* BTN_* for buttons, -1 for directions */
     int         dx, dy;      /* direction contribution */
+    int         turbo_hz;    /* --turbo autofire rate for buttons, 0 = off */
 } Mapping;
 
-static Mapping g_map[NUM_MAPPINGS];
-static int g_dir_held[NUM_DIRECTIONS];
+/* Everything one virtual joystick needs: its mapping, the compiled
+ * dispatch table, held-key state and its own uinput device and frame.
+ * The translation code works on g_player, which the event loop points
+ * at the player a keyboard feeds before handing over its events. */
+typedef struct {
+    Mapping  map[NUM_MAPPINGS];
+    Mapping  base_map[NUM_MAPPINGS];  /* without the per-game profile */
+
+    /* Compiled dispatch table: bit i of keymap[code] is set when that
+     * key drives map[i], so one key may feed any number of outputs.
+     * Bits 0-7 are directions, bits 8-15 buttons.
+     *
+     * Double-buffered: build_keymap() fills the spare table and then
+     * swaps the pointer, so a remap never exposes a half-built table. */
+    uint16_t  keymaps[2][KEY_CNT];
+    uint16_t *keymap;
+    uint8_t   macro_key[KEY_CNT];     /* macro index + 1, 0 = none */
+
+    uint8_t  dir_mask;        /* bit d set while direction d is held */
+    uint32_t dir_order;       /* held directions in press order, one per
+                               * nibble, oldest lowest (--socd) */
+    int      dir_order_len;
+    int      axis_x, axis_y;  /* last values sent, to skip unchanged axes */
+    int      axis_dirty;      /* dir_mask changed this frame */
+    int      ramp_sign[2];    /* --ramp: direction each axis is ramping */
+    uint64_t ramp_start[2];   /* when that direction was first held */
+    uint64_t ramp_next;       /* next ramp update, 0 when settled */
+
+    /* Output sources, combined when sent: a button is down while any
+     * source holds it (bit per BTN_TRIGGER-relative code); a playing
+     * macro overrides the stick, keys override the merged joystick */
+    uint16_t btn_kbd;         /* buttons held by keys (and turbo) */
+    uint16_t btn_macro;       /* by macros being played */
+    uint16_t btn_joy;         /* by the --merge-joystick stick */
+    int16_t  macro_axis[2];   /* axis a macro drives, -1 when none */
+    uint8_t  joy_axis[2];     /* merged stick, scaled to AXIS_MIN..MAX */
+
+    uint16_t turbo_held;      /* turbo buttons held, see turbo_tick() */
+    uint16_t turbo_on;        /* and their current output state */
+    uint64_t turbo_next[NUM_MAPPINGS];
+    uint16_t macro_active;    /* bit i set while g_macros[i] plays */
+    int      macro_pos[MAX_MACROS];   /* next record to play */
+    uint64_t macro_next[MAX_MACROS];  /* when it is due */
+
+    int      uinput_fd;
+    struct input_event frame[MAX_FRAME_EVENTS];  /* pending uinput frame */
+    int      frame_len;
+    struct {
+        struct timespec ts;
+        clockid_t       clock;
+    } lat_pending[MAX_FRAME_EVENTS];  /* --latency: kernel timestamps of
+                               * the input behind frame, and their clock */
+    int      lat_npending;
+} Player;
+
+static Player g_players[MAX_PLAYERS];
+static Player *g_player = &g_players[0];   /* player being translated */
+static int g_num_players = 1;               /* --players N */
+static int g_split;                         /* --split: all keyboards feed
+                                             * every player */
+#define ALL_PLAYERS  ((1u << g_num_players) - 1)
+
+/* --socd: how opposite directions held together resolve */
+#define SOCD_NEUTRAL  0   /* sum and clamp: Left+Right = centre */
+#define SOCD_LAST     1   /* per axis, the most recently pressed wins */
+#define SOCD_FIRST    2   /* per axis, the earliest pressed wins */
+static int g_socd = SOCD_NEUTRAL;
+
+/* --ramp MS: ease axes out to full deflection over MS while held,
+ * updated --ramp-rate times a second */
+#define RAMP_DEFAULT_HZ  100
+static int g_ramp_ms;
+static int g_ramp_hz = RAMP_DEFAULT_HZ;
+
+/* (ABS_X, ABS_Y) for every combination of held directions */
+static uint8_t g_axis_lut[1 << NUM_DIRECTIONS][2];
+
+static void build_keymap(void)
+{
+    Player *pl = g_player;
+    uint16_t *spare = (pl->keymap == pl->keymaps[0]) ? pl->keymaps[1] : pl->keymaps[0];
+
+    memset(spare, 0, sizeof(pl->keymaps[0]));
+    for (int i = 0; i < NUM_MAPPINGS; i++) {
+        int kc = pl->map[i].keycode;
+        if (kc > 0 && kc < KEY_CNT)
+            spare[kc] |= (uint16_t)(1u << i);
+    }
+    __atomic_store_n(&pl->keymap, spare, __ATOMIC_RELEASE);
+}
+
+static int axis_value(int sum)
+{
+    return (sum < 0) ? AXIS_MIN : (sum > 0) ? AXIS_MAX : AXIS_CENTER;
+}
+
+/* Directions cancel and combine by summing their dx/dy, so opposite
+ * keys give centre and a cardinal plus a diagonal can give either. */
+static void build_axis_lut(void)
+{
+    for (int mask = 0; mask < (1 << NUM_DIRECTIONS); mask++) {
+        int sx = 0, sy = 0;
+        for (int d = 0; d < NUM_DIRECTIONS; d++) {
+            if (mask & (1 << d)) {
+                sx += g_player->map[d].dx;
+                sy += g_player->map[d].dy;
+            }
+        }
+        g_axis_lut[mask][0] = (uint8_t)axis_value(sx);
+        g_axis_lut[mask][1] = (uint8_t)axis_value(sy);
+    }
+}
 
 static void init_mappings(void)
 {
     /* Directions (indices 0-7) */
-    g_map[0]  = (Mapping){"--up",        "Up",         KEY_W,          KEY_W,          -1, 0, -1};
-    g_map[1]  = (Mapping){"--down",      "Down",       KEY_X,          KEY_X,          -1, 0,  1};
-    g_map[2]  = (Mapping){"--left",      "Left",       KEY_A,          KEY_A,          -1,-1,  0};
-    g_map[3]  = (Mapping){"--right",     "Right",      KEY_D,          KEY_D,          -1, 1,  0};
-    g_map[4]  = (Mapping){"--upleft",    "Up-Left",    KEY_Q,          KEY_Q,          -1,-1, -1};
-    g_map[5]  = (Mapping){"--upright",   "Up-Right",   KEY_E,          KEY_E,          -1, 1, -1};
-    g_map[6]  = (Mapping){"--downleft",  "Down-Left",  KEY_Z,          KEY_Z,          -1,-1,  1};
-    g_map[7]  = (Mapping){"--downright", "Down-Right", KEY_C,          KEY_C,          -1, 1,  1};
+    Mapping *m = g_players[0].map;
+
+    m[0]  = (Mapping){"--up",        "Up",         KEY_W,          KEY_W,          -1, 0, -1, 0};
+    m[1]  = (Mapping){"--down",      "Down",       KEY_X,          KEY_X,          -1, 0,  1, 0};
+    m[2]  = (Mapping){"--left",      "Left",       KEY_A,          KEY_A,          -1,-1,  0, 0};
+    m[3]  = (Mapping){"--right",     "Right",      KEY_D,          KEY_D,          -1, 1,  0, 0};
+    m[4]  = (Mapping){"--upleft",    "Up-Left",    KEY_Q,          KEY_Q,          -1,-1, -1, 0};
+    m[5]  = (Mapping){"--upright",   "Up-Right",   KEY_E,          KEY_E,          -1, 1, -1, 0};
+    m[6]  = (Mapping){"--downleft",  "Down-Left",  KEY_Z,          KEY_Z,          -1,-1,  1, 0};
+    m[7]  = (Mapping){"--downright", "Down-Right", KEY_C,          KEY_C,          -1, 1,  1, 0};
     /* Buttons (indices 8-15) */
-    g_map[8]  = (Mapping){"--leftfire",  "Left Fire",  KEY_SPACE,      KEY_SPACE,      BTN_TRIGGER, 0, 0};
-    g_map[9]  = (Mapping){"--rightfire", "Right Fire",  KEY_LEFTALT,    KEY_LEFTALT,    BTN_THUMB,   0, 0};
-    g_map[10] = (Mapping){"--lefttri",   "Left Tri",   KEY_LEFTBRACE,  KEY_LEFTBRACE,  BTN_THUMB2,     0, 0};
-    g_map[11] = (Mapping){"--righttri",  "Right Tri",  KEY_RIGHTBRACE, KEY_RIGHTBRACE, BTN_TOP,  0, 0};
-    g_map[12] = (Mapping){"--menu1",     "Menu 1",     KEY_7,          KEY_7,          BTN_TOP2,    0, 0};
-    g_map[13] = (Mapping){"--menu2",     "Menu 2",     KEY_8,          KEY_8,          BTN_PINKIE,  0, 0};
-    g_map[14] = (Mapping){"--menu3",     "Menu 3",     KEY_9,          KEY_9,          BTN_BASE,    0, 0};
-    g_map[15] = (Mapping){"--menu4",     "Menu 4",     KEY_0,          KEY_0,          BTN_BASE2,   0, 0};
-
-    memset(g_dir_held, 0, sizeof(g_dir_held));
+    m[8]  = (Mapping){"--leftfire",  "Left Fire",  KEY_SPACE,      KEY_SPACE,      BTN_TRIGGER, 0, 0, 0};
+    m[9]  = (Mapping){"--rightfire", "Right Fire",  KEY_LEFTALT,    KEY_LEFTALT,    BTN_THUMB,   0, 0, 0};
+    m[10] = (Mapping){"--lefttri",   "Left Tri",   KEY_LEFTBRACE,  KEY_LEFTBRACE,  BTN_THUMB2,     0, 0, 0};
+    m[11] = (Mapping){"--righttri",  "Right Tri",  KEY_RIGHTBRACE, KEY_RIGHTBRACE, BTN_TOP,  0, 0, 0};
+    m[12] = (Mapping){"--menu1",     "Menu 1",     KEY_7,          KEY_7,          BTN_TOP2,    0, 0, 0};
+    m[13] = (Mapping){"--menu2",     "Menu 2",     KEY_8,          KEY_8,          BTN_PINKIE,  0, 0, 0};
+    m[14] = (Mapping){"--menu3",     "Menu 3",     KEY_9,          KEY_9,          BTN_BASE,    0, 0, 0};
+    m[15] = (Mapping){"--menu4",     "Menu 4",     KEY_0,          KEY_0,          BTN_BASE2,   0, 0, 0};
+
+    /* Every player starts from the same defaults */
+    for (int p = 0; p < MAX_PLAYERS; p++) {
+        Player *pl = &g_players[p];
+        if (p) memcpy(pl->map, m, sizeof(pl->map));
+        pl->keymap    = pl->keymaps[0];
+        pl->axis_x    = pl->axis_y = AXIS_CENTER;
+        pl->joy_axis[0] = pl->joy_axis[1] = AXIS_CENTER;
+        pl->macro_axis[0] = pl->macro_axis[1] = -1;
+        pl->uinput_fd = -1;
+        g_player = pl;
+        build_keymap();
+    }
+    g_player = &g_players[0];
+    build_axis_lut();
 }
 
 /* ================================================================
  * Globals and forward declarations
  * ================================================================ */
 
-static volatile sig_atomic_t g_quit = 0;
-static int g_uinput_fd = -1;
+static int g_quit;   /* set by a signal, read by both threads: atomic */
+static volatile sig_atomic_t g_dump_stats = 0;  /* SIGUSR1 */
+static volatile sig_atomic_t g_child_exited = 0; /* SIGCHLD */
+static volatile sig_atomic_t g_reload = 0;       /* SIGHUP */
+static int g_latency;                            /* --latency */
 static int g_kbd_fds[MAX_KEYBOARDS];
 static int g_num_kbd_fds = 0;
 static int g_kbd_grabbed[MAX_KEYBOARDS];
+static unsigned g_kbd_rep[MAX_KEYBOARDS][2];  /* autorepeat saved by grab */
+static int g_kbd_rep_off[MAX_KEYBOARDS];       /* and whether it is off */
+static char g_kbd_nodes[MAX_KEYBOARDS][KBD_NODE_LEN];  /* /dev/input name */
+static uint8_t g_kbd_players[MAX_KEYBOARDS];  /* players a keyboard feeds */
 static int g_ctrl_held;
 static int g_suspended;
+static int g_remap_active;    /* the GUI thread is remapping a player */
+static int g_remap_player;    /* which one; both accessed atomically */
+static int g_merge_player = -1;   /* --merge-joystick, or -1 */
+static int g_joy_fd = -1;         /* the joystick being merged */
+static char g_joy_node[KBD_NODE_LEN];
 
-static void emit_event(int fd, int type, int code, int value);
-static void emit_syn(int fd);
-static int guimap_run(void);
+static void emit_event(int type, int code, int value);
+static void emit_flush(int fd);
+static void gui_serve(void);
 
 static void sig_handler(int sig)
 {
-    (void)sig;
-    g_quit = 1;
+    if (sig == SIGUSR1)
+        g_dump_stats = 1;
+    else if (sig == SIGCHLD)
+        g_child_exited = 1;
+    else if (sig == SIGHUP)
+        g_reload = 1;
+    else
+        __atomic_store_n(&g_quit, 1, __ATOMIC_RELAXED);
+}
+
+/* ================================================================
+ * Signals
+ *
+ * Our signals are blocked while the event loop runs and delivered
+ * through a signalfd, so the loop can sleep in epoll_wait() without
+ * racing against g_quit; they are blocked before the translation thread
+ * starts, so the remap GUI thread never sees them. Standalone --guimap
+ * instead lets SIGINT/SIGTERM reach sig_handler inside ppoll();
+ * children get a clean mask from the64_start().
+ * ================================================================ */
+
+static sigset_t g_sig_mask;
+static int g_sig_fd = -1;
+
+static void signals_init(void)
+{
+    sigemptyset(&g_sig_mask);
+    sigaddset(&g_sig_mask, SIGINT);
+    sigaddset(&g_sig_mask, SIGTERM);
+    sigaddset(&g_sig_mask, SIGUSR1);
+    sigaddset(&g_sig_mask, SIGCHLD);
+    sigaddset(&g_sig_mask, SIGHUP);
+    signal(SIGINT, sig_handler);
+    signal(SIGTERM, sig_handler);
+    signal(SIGUSR1, sig_handler);
+    signal(SIGCHLD, sig_handler);
+    signal(SIGHUP, sig_handler);
+}
+
+static void signals_block(void)
+{
+    if (sigprocmask(SIG_BLOCK, &g_sig_mask, NULL) < 0)
+        return;
+    if (g_sig_fd < 0) {
+        g_sig_fd = signalfd(-1, &g_sig_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (g_sig_fd < 0) {
+            /* No signalfd: keep the handler and rely on EINTR */
+            perror("signalfd");
+            sigprocmask(SIG_UNBLOCK, &g_sig_mask, NULL);
+        }
+    }
+}
+
+static void signals_drain(void)
+{
+    struct signalfd_siginfo si;
+    while (read(g_sig_fd, &si, sizeof(si)) == (ssize_t)sizeof(si))
+        sig_handler((int)si.ssi_signo);
 }
 
 /* ================================================================
@@ -384,27 +616,212 @@ static uint64_t time_ms(void)
     return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+static uint64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* ================================================================
+ * Event loop (epoll, with a poll() fallback)
+ *
+ * Each registered fd carries a tag: the source kind in the high 16
+ * bits and an index (e.g. keyboard slot) in the low 16 bits.
+ * ================================================================ */
+
+#define SRC_KBD           1
+#define SRC_SIGNAL        2
+#define SRC_HOTPLUG       3
+#define SRC_GAME          4
+#define SRC_TIMER         5
+#define SRC_GUI           6
+#define SRC_JOY           7
+
+#define LOOP_TAG(src, idx)  (((uint32_t)(src) << 16) | (uint32_t)(idx))
+#define LOOP_SRC(tag)       ((tag) >> 16)
+#define LOOP_IDX(tag)       ((tag) & 0xFFFF)
+
+typedef struct {
+    int      epfd;               /* epoll instance, or -1 for poll() */
+    int      nfds;
+    int      fds[MAX_LOOP_FDS];
+    uint32_t tags[MAX_LOOP_FDS];
+} EventLoop;
+
+static void loop_init(EventLoop *loop)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0)
+        fprintf(stderr, "epoll unavailable (%s), using poll()\n",
+                strerror(errno));
+}
+
+static int loop_add(EventLoop *loop, int fd, uint32_t tag)
+{
+    if (loop->nfds >= MAX_LOOP_FDS) return -1;
+    if (loop->epfd >= 0) {
+        struct epoll_event ee;
+        memset(&ee, 0, sizeof(ee));
+        ee.events   = EPOLLIN;
+        ee.data.u32 = tag;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ee) < 0) {
+            perror("epoll_ctl add");
+            return -1;
+        }
+    }
+    loop->fds[loop->nfds]  = fd;
+    loop->tags[loop->nfds] = tag;
+    loop->nfds++;
+    return 0;
+}
+
+static void loop_set_tag(EventLoop *loop, int fd, uint32_t tag)
+{
+    for (int i = 0; i < loop->nfds; i++) {
+        if (loop->fds[i] != fd) continue;
+        loop->tags[i] = tag;
+        if (loop->epfd >= 0) {
+            struct epoll_event ee;
+            memset(&ee, 0, sizeof(ee));
+            ee.events   = EPOLLIN;
+            ee.data.u32 = tag;
+            epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ee);
+        }
+        return;
+    }
+}
+
+static void loop_del(EventLoop *loop, int fd)
+{
+    for (int i = 0; i < loop->nfds; i++) {
+        if (loop->fds[i] != fd) continue;
+        if (loop->epfd >= 0)
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+        loop->nfds--;
+        loop->fds[i]  = loop->fds[loop->nfds];
+        loop->tags[i] = loop->tags[loop->nfds];
+        return;
+    }
+}
+
+/* Block until at least one fd is ready (or timeout_ms elapses, -1 for
+ * no timeout). Fills ready[] with tags, returns how many; 0 on timeout
+ * or EINTR. */
+static int loop_wait(EventLoop *loop, uint32_t *ready, int max_ready,
+                     int timeout_ms)
+{
+    int n = 0;
+
+    if (loop->epfd >= 0) {
+        struct epoll_event evs[MAX_LOOP_FDS];
+        if (max_ready > MAX_LOOP_FDS) max_ready = MAX_LOOP_FDS;
+        int r = epoll_wait(loop->epfd, evs, max_ready, timeout_ms);
+        for (int i = 0; i < r; i++)
+            ready[n++] = evs[i].data.u32;
+        return n;
+    }
+
+    struct pollfd pfds[MAX_LOOP_FDS];
+    for (int i = 0; i < loop->nfds; i++) {
+        pfds[i].fd      = loop->fds[i];
+        pfds[i].events  = POLLIN;
+        pfds[i].revents = 0;
+    }
+    if (poll(pfds, loop->nfds, timeout_ms) <= 0)
+        return 0;
+    for (int i = 0; i < loop->nfds && n < max_ready; i++)
+        if (pfds[i].revents)
+            ready[n++] = loop->tags[i];
+    return n;
+}
+
+static void loop_destroy(EventLoop *loop)
+{
+    if (loop->epfd >= 0) close(loop->epfd);
+    loop->epfd = -1;
+    loop->nfds = 0;
+}
+
+static EventLoop g_loop;
+
+/* One timerfd for everything time-driven, armed to the earliest
+ * CLOCK_MONOTONIC deadline and disarmed when nothing is pending, so
+ * an idle loop never wakes up. */
+static int g_timer_fd = -1;
+static uint64_t g_timer_armed;   /* absolute ns currently armed, 0 = off */
+
+static int timer_init(void)
+{
+    g_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (g_timer_fd < 0)
+        perror("timerfd_create");
+    g_timer_armed = 0;
+    return g_timer_fd;
+}
+
+/* Arm for absolute deadline_ns (0 disarms); no syscall if unchanged */
+static void timer_arm(uint64_t deadline_ns)
+{
+    struct itimerspec its;
+
+    if (g_timer_fd < 0 || deadline_ns == g_timer_armed) return;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = deadline_ns / 1000000000ull;
+    its.it_value.tv_nsec = deadline_ns % 1000000000ull;
+    timerfd_settime(g_timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    g_timer_armed = deadline_ns;
+}
+
+/* Consume the expiry count after the timer fired */
+static void timer_ack(void)
+{
+    uint64_t expirations;
+
+    if (read(g_timer_fd, &expirations, sizeof(expirations)) < 0 &&
+        errno != EAGAIN)
+        perror("read timerfd");
+    g_timer_armed = 0;
+}
+
+#ifndef K2J_NO_GUIMAP
+
 /* ================================================================
  * Framebuffer
  * ================================================================ */
 
+typedef struct { int x, y, w, h; } Rect;
+
 typedef struct {
     int       fd;
     uint32_t *pixels;
-    uint32_t *backbuf;
+    uint32_t *backbuf;     /* hidden page, or malloc'd copy buffer */
     int       width;
     int       height;
     int       stride_px;
-    size_t    size;
+    size_t    size;        /* one page */
+    size_t    map_size;
+    int       page_flip;   /* 1: two pages in the mmap, flip by panning */
+    int       front;       /* visible page in page_flip mode */
+    int       has_vsync;
+    struct fb_var_screeninfo vinfo;
+    Rect      damage[MAX_DAMAGE];  /* regions changed since last flip */
+    int       num_damage;
 } Framebuffer;
 
+static uint32_t *fb_page(Framebuffer *fb, int page)
+{
+    return fb->pixels + (size_t)page * fb->stride_px * fb->height;
+}
+
 static int fb_init(Framebuffer *fb)
 {
     struct fb_var_screeninfo vinfo;
     struct fb_fix_screeninfo finfo;
 
     memset(fb, 0, sizeof(*fb));
-    fb->fd = open("/dev/fb0", O_RDWR);
+    fb->fd = open("/dev/fb0", O_RDWR | O_CLOEXEC);
     if (fb->fd < 0) { perror("open /dev/fb0"); return -1; }
 
     if (ioctl(fb->fd, FBIOGET_VSCREENINFO, &vinfo) < 0) {
@@ -424,39 +841,156 @@ static int fb_init(Framebuffer *fb)
      * and may leave yoffset pointing at a different page. */
     vinfo.yoffset = 0;
     vinfo.xoffset = 0;
-    ioctl(fb->fd, FBIOPAN_DISPLAY, &vinfo);
+    int can_pan = ioctl(fb->fd, FBIOPAN_DISPLAY, &vinfo) == 0;
+
+    /* With a second page we draw into the hidden one and pan to it */
+    fb->page_flip = can_pan && vinfo.yres_virtual >= 2 * vinfo.yres &&
+                    finfo.smem_len >= 2 * fb->size;
+    fb->map_size  = fb->page_flip ? 2 * fb->size : fb->size;
+    fb->vinfo     = vinfo;
 
-    fb->pixels = mmap(NULL, fb->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+    fb->pixels = mmap(NULL, fb->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
                        fb->fd, 0);
     if (fb->pixels == MAP_FAILED) {
         perror("mmap framebuffer"); close(fb->fd); return -1;
     }
 
+    if (fb->page_flip) {
+        uint32_t arg = 0;
+        fb->has_vsync = ioctl(fb->fd, FBIO_WAITFORVSYNC, &arg) == 0;
+        fb->front   = 0;
+        fb->backbuf = fb_page(fb, 1);
+        memset(fb->backbuf, 0, fb->size);
+        fprintf(stderr, "Framebuffer: page flipping%s\n",
+                fb->has_vsync ? " with vsync" : "");
+        return 0;
+    }
+
     fb->backbuf = malloc(fb->size);
     if (!fb->backbuf) {
-        munmap(fb->pixels, fb->size); close(fb->fd); return -1;
+        munmap(fb->pixels, fb->map_size); close(fb->fd); return -1;
     }
     memset(fb->backbuf, 0, fb->size);
     return 0;
 }
 
+/* Mark a back buffer region as changed. When the list is full the
+ * regions collapse into their bounding box. */
+static void fb_damage(Framebuffer *fb, int x, int y, int w, int h)
+{
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > fb->width)  w = fb->width - x;
+    if (y + h > fb->height) h = fb->height - y;
+    if (w <= 0 || h <= 0) return;
+
+    if (fb->num_damage == MAX_DAMAGE) {
+        Rect *u = &fb->damage[0];
+        for (int i = 1; i < fb->num_damage; i++) {
+            Rect *r = &fb->damage[i];
+            int x1 = u->x + u->w > r->x + r->w ? u->x + u->w : r->x + r->w;
+            int y1 = u->y + u->h > r->y + r->h ? u->y + u->h : r->y + r->h;
+            if (r->x < u->x) u->x = r->x;
+            if (r->y < u->y) u->y = r->y;
+            u->w = x1 - u->x;
+            u->h = y1 - u->y;
+        }
+        fb->num_damage = 1;
+    }
+    fb->damage[fb->num_damage++] = (Rect){ x, y, w, h };
+}
+
+static void fb_copy_damage(Framebuffer *fb, uint32_t *dst,
+                           const uint32_t *src)
+{
+    for (int i = 0; i < fb->num_damage; i++) {
+        const Rect *r = &fb->damage[i];
+        if (r->x == 0 && r->w == fb->width && fb->width == fb->stride_px) {
+            size_t off = (size_t)r->y * fb->stride_px;
+            memcpy(dst + off, src + off,
+                   (size_t)r->h * fb->stride_px * sizeof(uint32_t));
+            continue;
+        }
+        for (int y = r->y; y < r->y + r->h; y++) {
+            size_t off = (size_t)y * fb->stride_px + r->x;
+            memcpy(dst + off, src + off, (size_t)r->w * sizeof(uint32_t));
+        }
+    }
+}
+
+/* Show the back buffer; no-op if nothing was damaged. In page_flip
+ * mode the hidden page is panned in, then the frame's damage is
+ * copied into the page that just went hidden so both stay current.
+ * Otherwise only the damaged regions are copied to the screen. */
 static void fb_flip(Framebuffer *fb)
 {
-    memcpy(fb->pixels, fb->backbuf, fb->size);
+    if (fb->num_damage == 0) return;
+
+    if (fb->page_flip) {
+        int back = !fb->front;
+        fb->vinfo.yoffset = back * fb->height;
+        if (ioctl(fb->fd, FBIOPAN_DISPLAY, &fb->vinfo) == 0) {
+            if (fb->has_vsync) {
+                uint32_t arg = 0;
+                ioctl(fb->fd, FBIO_WAITFORVSYNC, &arg);
+            }
+            fb->front   = back;
+            fb->backbuf = fb_page(fb, !back);
+            fb_copy_damage(fb, fb->backbuf, fb_page(fb, back));
+        } else {
+            perror("FBIOPAN_DISPLAY");
+        }
+    } else {
+        fb_copy_damage(fb, fb->pixels, fb->backbuf);
+    }
+    fb->num_damage = 0;
+}
+
+/* Solid fill of n pixels: 128-bit NEON stores on ARM, 64-bit
+ * stores elsewhere. may_alias keeps the 64-bit stores ordered against
+ * the uint32_t pixel accesses around them. */
+typedef uint64_t __attribute__((may_alias)) u64a;
+
+static inline void fill_span(uint32_t *p, int n, uint32_t c)
+{
+#ifdef __ARM_NEON
+    uint32x4_t v = vdupq_n_u32(c);
+    for (; n >= 4; n -= 4, p += 4)
+        vst1q_u32(p, v);
+#else
+    if (((uintptr_t)p & 7) && n > 0) { *p++ = c; n--; }
+    uint64_t c2 = ((uint64_t)c << 32) | c;
+    u64a *q = (u64a *)p;
+    for (; n >= 8; n -= 8, q += 4) {
+        q[0] = c2; q[1] = c2; q[2] = c2; q[3] = c2;
+    }
+    for (; n >= 2; n -= 2) *q++ = c2;
+    p = (uint32_t *)q;
+#endif
+    while (n-- > 0) *p++ = c;
 }
 
 static void fb_clear(Framebuffer *fb, uint32_t color)
 {
-    int total = fb->stride_px * fb->height;
-    for (int i = 0; i < total; i++)
-        fb->backbuf[i] = color;
+    fill_span(fb->backbuf, fb->stride_px * fb->height, color);
+    fb->num_damage = 0;
+    fb_damage(fb, 0, 0, fb->width, fb->height);
 }
 
 static void fb_destroy(Framebuffer *fb)
 {
-    if (fb->backbuf) free(fb->backbuf);
+    if (fb->page_flip) {
+        /* Leave the display on page 0 as fb_init() found it */
+        if (fb->front != 0) {
+            memcpy(fb_page(fb, 0), fb_page(fb, fb->front), fb->size);
+            fb->vinfo.yoffset = 0;
+            ioctl(fb->fd, FBIOPAN_DISPLAY, &fb->vinfo);
+        }
+    } else if (fb->backbuf) {
+        free(fb->backbuf);
+    }
     if (fb->pixels && fb->pixels != MAP_FAILED)
-        munmap(fb->pixels, fb->size);
+        munmap(fb->pixels, fb->map_size);
     if (fb->fd >= 0) close(fb->fd);
 }
 
@@ -464,17 +998,26 @@ static void fb_destroy(Framebuffer *fb)
  * Drawing primitives
  * ================================================================ */
 
-static inline void draw_pixel(Framebuffer *fb, int x, int y, uint32_t c)
+/* All primitives bottom out here: clip once, then fill row spans */
+static void draw_rect(Framebuffer *fb, int x, int y, int w, int h, uint32_t c)
 {
-    if (x >= 0 && x < fb->width && y >= 0 && y < fb->height)
-        fb->backbuf[y * fb->stride_px + x] = c;
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > fb->width)  w = fb->width - x;
+    if (y + h > fb->height) h = fb->height - y;
+    if (w <= 0 || h <= 0) return;
+
+    uint32_t *row = fb->backbuf + (size_t)y * fb->stride_px + x;
+    for (; h > 0; h--, row += fb->stride_px)
+        fill_span(row, w, c);
 }
 
-static void draw_rect(Framebuffer *fb, int x, int y, int w, int h, uint32_t c)
+/* Fill a region with background and mark it for the next flip */
+static void fb_clear_rect(Framebuffer *fb, int x, int y, int w, int h,
+                          uint32_t c)
 {
-    for (int row = y; row < y + h; row++)
-        for (int col = x; col < x + w; col++)
-            draw_pixel(fb, col, row, c);
+    draw_rect(fb, x, y, w, h, c);
+    fb_damage(fb, x, y, w, h);
 }
 
 static void draw_circle(Framebuffer *fb, int cx, int cy, int r, uint32_t c)
@@ -531,22 +1074,51 @@ static void draw_triangle_filled(Framebuffer *fb, int x0, int y0,
  * Text rendering (built-in 8x16 font)
  * ================================================================ */
 
+/* Font rows pre-split into runs of lit pixels (at most 4 per 8-bit
+ * row), so a glyph is drawn as a handful of spans at any scale and
+ * colour instead of one rectangle per lit bit. */
+typedef struct { uint8_t start, len; } GlyphRun;
+typedef struct {
+    GlyphRun run[FONT_H][FONT_W / 2];
+    uint8_t  nruns[FONT_H];
+} GlyphSpans;
+
+static GlyphSpans g_glyphs[95];
+static int g_glyphs_ready;
+
+static void build_glyph_spans(void)
+{
+    for (int g = 0; g < 95; g++) {
+        for (int row = 0; row < FONT_H; row++) {
+            uint8_t bits = font8x16[g][row];
+            int n = 0;
+            for (int col = 0; col < FONT_W; ) {
+                if (!(bits & (0x80 >> col))) { col++; continue; }
+                int start = col;
+                while (col < FONT_W && (bits & (0x80 >> col))) col++;
+                g_glyphs[g].run[row][n].start = (uint8_t)start;
+                g_glyphs[g].run[row][n].len   = (uint8_t)(col - start);
+                n++;
+            }
+            g_glyphs[g].nruns[row] = (uint8_t)n;
+        }
+    }
+    g_glyphs_ready = 1;
+}
+
 static void draw_char(Framebuffer *fb, int x, int y, char ch, uint32_t c,
                        int scale)
 {
     int idx = (unsigned char)ch - 0x20;
     if (idx < 0 || idx >= 95) return;
-    const uint8_t *glyph = font8x16[idx];
+    if (!g_glyphs_ready) build_glyph_spans();
+
+    const GlyphSpans *gs = &g_glyphs[idx];
     for (int row = 0; row < FONT_H; row++) {
-        uint8_t bits = glyph[row];
-        for (int col = 0; col < FONT_W; col++) {
-            if (bits & (0x80 >> col)) {
-                if (scale == 1)
-                    draw_pixel(fb, x + col, y + row, c);
-                else
-                    draw_rect(fb, x + col * scale, y + row * scale,
-                              scale, scale, c);
-            }
+        for (int r = 0; r < gs->nruns[row]; r++) {
+            const GlyphRun *run = &gs->run[row][r];
+            draw_rect(fb, x + run->start * scale, y + row * scale,
+                      run->len * scale, scale, c);
         }
     }
 }
@@ -572,6 +1144,299 @@ static void draw_text_centered(Framebuffer *fb, int cx, int y, const char *text,
     draw_text(fb, cx - text_width(text, scale) / 2, y, text, c, scale);
 }
 
+#endif /* K2J_NO_GUIMAP */
+
+/* ================================================================
+ * Latency instrumentation (--latency)
+ *
+ * Records the time from the kernel's timestamp on a keyboard event to
+ * our write() of the resulting uinput frame. Samples go into a fixed
+ * log-scale histogram (4 buckets per power of two microseconds) with
+ * relaxed atomic updates only: no locks, allocation or stdio on the
+ * hot path. latency_dump() prints it on SIGUSR1 and at exit.
+ * ================================================================ */
+
+typedef struct {
+    uint32_t buckets[LAT_BUCKETS];
+    uint64_t count;
+    uint64_t sum_us;
+    uint32_t min_us;
+    uint32_t max_us;
+} LatencyHist;
+
+static LatencyHist g_lat = { .min_us = UINT32_MAX };
+/* Clock of the device whose events are being translated, set from its
+ * EvReader before they are read (translation thread only) */
+static clockid_t g_lat_clock = CLOCK_MONOTONIC;
+
+/* Ask for CLOCK_MONOTONIC timestamps on fd; returns the clock its
+ * events will carry */
+static clockid_t latency_set_clock(int fd)
+{
+    int clk = CLOCK_MONOTONIC;
+    if (ioctl(fd, EVIOCSCLOCKID, &clk) == 0)
+        return CLOCK_MONOTONIC;
+    fprintf(stderr, "Warning: EVIOCSCLOCKID failed on fd %d, its latency "
+                    "uses CLOCK_REALTIME\n", fd);
+    return CLOCK_REALTIME;
+}
+
+static int lat_bucket(uint32_t us)
+{
+    if (us < 4) return (int)us;
+    int e = 31 - __builtin_clz(us);             /* >= 2 */
+    return 4 * (e - 1) + (int)((us >> (e - 2)) & 3);
+}
+
+static uint32_t lat_bucket_floor(int idx)
+{
+    if (idx < 4) return (uint32_t)idx;
+    int e = idx / 4 + 1;
+    return (uint32_t)(4 + idx % 4) << (e - 2);
+}
+
+/* ev produced output for g_player: time it from ev's kernel timestamp
+ * until that player's frame is written. Marks whose frame turns out
+ * empty or fails to write are dropped, see translate_flush(). */
+static void latency_mark(const struct input_event *ev)
+{
+    Player *pl = g_player;
+
+    if (pl->lat_npending >= MAX_FRAME_EVENTS) return;
+    struct timespec *ts = &pl->lat_pending[pl->lat_npending].ts;
+    ts->tv_sec  = ev->input_event_sec;
+    ts->tv_nsec = ev->input_event_usec * 1000;
+    pl->lat_pending[pl->lat_npending++].clock = g_lat_clock;
+}
+
+static void latency_record(void)
+{
+    Player *pl = g_player;
+    struct timespec now[2];   /* CLOCK_MONOTONIC, CLOCK_REALTIME */
+    int have[2] = { 0, 0 };
+
+    for (int i = 0; i < pl->lat_npending; i++) {
+        const struct timespec *ts = &pl->lat_pending[i].ts;
+        int c = pl->lat_pending[i].clock == CLOCK_REALTIME;
+        if (!have[c]) {
+            clock_gettime(pl->lat_pending[i].clock, &now[c]);
+            have[c] = 1;
+        }
+        int64_t ns = (int64_t)(now[c].tv_sec - ts->tv_sec) * 1000000000
+                   + (now[c].tv_nsec - ts->tv_nsec);
+        uint32_t us = ns < 0 ? 0 : ns / 1000 > UINT32_MAX ? UINT32_MAX
+                                                          : (uint32_t)(ns / 1000);
+        uint32_t cur;
+
+        __atomic_fetch_add(&g_lat.buckets[lat_bucket(us)], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_lat.count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_lat.sum_us, us, __ATOMIC_RELAXED);
+        cur = __atomic_load_n(&g_lat.min_us, __ATOMIC_RELAXED);
+        while (us < cur && !__atomic_compare_exchange_n(&g_lat.min_us, &cur, us,
+                       1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+        cur = __atomic_load_n(&g_lat.max_us, __ATOMIC_RELAXED);
+        while (us > cur && !__atomic_compare_exchange_n(&g_lat.max_us, &cur, us,
+                       1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+    pl->lat_npending = 0;
+}
+
+/* Smallest bucket floor below which at least pct% of samples fall */
+static uint32_t latency_percentile(uint64_t count, int pct)
+{
+    uint64_t want = (count * pct + 99) / 100, seen = 0;
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        seen += __atomic_load_n(&g_lat.buckets[i], __ATOMIC_RELAXED);
+        if (seen >= want) return lat_bucket_floor(i);
+    }
+    return 0;
+}
+
+static void latency_dump(void)
+{
+    uint64_t count = __atomic_load_n(&g_lat.count, __ATOMIC_RELAXED);
+
+    if (!g_latency) {
+        fprintf(stderr, "Latency instrumentation is off (use --latency)\n");
+        return;
+    }
+    if (count == 0) {
+        fprintf(stderr, "Latency: no samples yet\n");
+        return;
+    }
+    fprintf(stderr, "Latency key->uinput over %llu events (us): "
+            "min %u  p50 %u  p99 %u  max %u  mean %llu\n",
+            (unsigned long long)count,
+            __atomic_load_n(&g_lat.min_us, __ATOMIC_RELAXED),
+            latency_percentile(count, 50), latency_percentile(count, 99),
+            __atomic_load_n(&g_lat.max_us, __ATOMIC_RELAXED),
+            (unsigned long long)(__atomic_load_n(&g_lat.sum_us, __ATOMIC_RELAXED)
+                                 / count));
+}
+
+/* ================================================================
+ * Shared-memory counters (read with --stats)
+ *
+ * Normal mode keeps its operational counters in a small file mapped
+ * MAP_SHARED under /dev/shm (or /tmp), so another process can map it
+ * and sample them at any time without signals or log scraping. The
+ * hot path only does relaxed atomic adds into the mapping; before it
+ * exists (and in --bench) they go to a private copy instead.
+ * ================================================================ */
+
+#define STATS_MAGIC     "K2JSTATS"
+#define STATS_VERSION   2
+#define STATS_PATH      "/dev/shm/keyboard2thejoystick.stats"
+#define STATS_PATH_TMP  "/tmp/keyboard2thejoystick.stats"
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t size;            /* sizeof(StatsPage) */
+    uint32_t pid;
+    uint32_t num_keyboards;
+    uint64_t start_ns;        /* CLOCK_MONOTONIC */
+    uint64_t wakeups;         /* event loop iterations */
+    uint64_t events_in;       /* keyboard events read, all keyboards */
+    uint64_t frames_out;      /* uinput frames written */
+    uint64_t events_out;      /* events in them, SYN_REPORT included */
+    uint64_t write_errors;    /* failed uinput writes */
+    uint64_t grab_failures;
+    uint64_t keyboards_added; /* hotplug */
+    uint64_t keyboards_dropped;
+    uint64_t suspends;        /* Ctrl+S pauses */
+    uint64_t remaps;          /* Ctrl+R sessions */
+    uint64_t reloads;         /* SIGHUP */
+    uint64_t profile_switches;
+    uint64_t joy_events;      /* --merge-joystick input */
+    uint64_t kbd_events[MAX_KEYBOARDS];      /* per keyboard slot */
+    char     kbd_node[MAX_KEYBOARDS][KBD_NODE_LEN];
+} StatsPage;
+
+static StatsPage g_stats_local;
+static StatsPage *g_stats = &g_stats_local;
+
+#define STAT_ADD(field, n) \
+    __atomic_fetch_add(&g_stats->field, (n), __ATOMIC_RELAXED)
+
+/* Create the shared page; failing that, counting stays private.
+ * /dev/shm and /tmp are world-writable and we usually run as root, so
+ * the page is built in a fresh mkostemp() file and renamed over the
+ * fixed name: a planted symlink or file there is replaced, never
+ * followed or truncated, and readers only ever find a complete page. */
+static void stats_open(void)
+{
+    const char *paths[] = { STATS_PATH, STATS_PATH_TMP };
+
+    for (int i = 0; i < 2; i++) {
+        char tmp[MAX_PATH_LEN];
+        snprintf(tmp, sizeof(tmp), "%s.XXXXXX", paths[i]);
+        int fd = mkostemp(tmp, O_CLOEXEC);
+        if (fd < 0) continue;
+        StatsPage *st = MAP_FAILED;
+        if (fchmod(fd, 0644) == 0 && ftruncate(fd, sizeof(StatsPage)) == 0)
+            st = mmap(NULL, sizeof(StatsPage), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+        close(fd);
+        if (st == MAP_FAILED) {
+            unlink(tmp);
+            continue;
+        }
+
+        memset(st, 0, sizeof(*st));
+        memcpy(st->magic, STATS_MAGIC, 8);
+        st->version  = STATS_VERSION;
+        st->size     = sizeof(StatsPage);
+        st->pid      = (uint32_t)getpid();
+        st->start_ns = time_ns();
+        if (rename(tmp, paths[i]) < 0) {
+            unlink(tmp);
+            munmap(st, sizeof(StatsPage));
+            continue;
+        }
+        __atomic_store_n(&g_stats, st, __ATOMIC_RELEASE);
+        return;
+    }
+    fprintf(stderr, "Warning: cannot create %s, stats not exported\n",
+            STATS_PATH);
+}
+
+/* Publish which device each keyboard slot is */
+static void stats_keyboards(const char (*nodes)[KBD_NODE_LEN], int count)
+{
+    memcpy(g_stats->kbd_node, nodes, (size_t)count * KBD_NODE_LEN);
+    __atomic_store_n(&g_stats->num_keyboards, (uint32_t)count,
+                     __ATOMIC_RELAXED);
+}
+
+#define STAT_LOAD(st, field)  __atomic_load_n(&(st)->field, __ATOMIC_RELAXED)
+
+/* --stats: print the running instance's counters, with rates over
+ * one second */
+static int stats_show(void)
+{
+    const char *paths[] = { STATS_PATH, STATS_PATH_TMP };
+    const StatsPage *st = MAP_FAILED;
+
+    for (int i = 0; i < 2 && st == MAP_FAILED; i++) {
+        int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        struct stat sb;
+        if (fstat(fd, &sb) == 0 && sb.st_size >= (off_t)sizeof(StatsPage))
+            st = mmap(NULL, sizeof(StatsPage), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (st == MAP_FAILED || memcmp(st->magic, STATS_MAGIC, 8) != 0 ||
+        st->version != STATS_VERSION || st->size != sizeof(StatsPage)) {
+        fprintf(stderr, "Error: no stats found in %s or %s\n",
+                STATS_PATH, STATS_PATH_TMP);
+        return 1;
+    }
+
+    StatsPage a = *st;
+    sleep(1);
+
+    static const struct { const char *name; size_t off; } rows[] = {
+#define STAT_ROW(f, n) { n, offsetof(StatsPage, f) }
+        STAT_ROW(wakeups,           "loop wakeups"),
+        STAT_ROW(events_in,         "events read"),
+        STAT_ROW(frames_out,        "frames written"),
+        STAT_ROW(events_out,        "events written"),
+        STAT_ROW(write_errors,      "write errors"),
+        STAT_ROW(grab_failures,     "grab failures"),
+        STAT_ROW(keyboards_added,   "keyboards added"),
+        STAT_ROW(keyboards_dropped, "keyboards dropped"),
+        STAT_ROW(suspends,          "suspends"),
+        STAT_ROW(remaps,            "remaps"),
+        STAT_ROW(reloads,           "reloads"),
+        STAT_ROW(profile_switches,  "profile switches"),
+        STAT_ROW(joy_events,        "joystick events"),
+#undef STAT_ROW
+    };
+    int alive = kill((pid_t)st->pid, 0) == 0 || errno == EPERM;
+    printf("keyboard2thejoystick pid %u (%s), up %llu s\n", st->pid,
+           alive ? "running" : "not running",
+           (unsigned long long)((time_ns() - st->start_ns) / 1000000000ull));
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        uint64_t v0 = *(const uint64_t *)((const char *)&a + rows[i].off);
+        uint64_t v1 = __atomic_load_n((const uint64_t *)
+                                      ((const char *)st + rows[i].off),
+                                      __ATOMIC_RELAXED);
+        printf("  %-18s %12llu  %8llu/s\n", rows[i].name,
+               (unsigned long long)v1, (unsigned long long)(v1 - v0));
+    }
+    uint32_t nk = STAT_LOAD(st, num_keyboards);
+    for (uint32_t k = 0; k < nk && k < MAX_KEYBOARDS; k++) {
+        uint64_t v1 = STAT_LOAD(st, kbd_events[k]);
+        printf("  keyboard %-9.*s %12llu  %8llu/s\n", KBD_NODE_LEN,
+               st->kbd_node[k], (unsigned long long)v1,
+               (unsigned long long)(v1 - a.kbd_events[k]));
+    }
+    return 0;
+}
+
 /* ================================================================
  * Keyboard detection (adapted from gamepad_map.c)
  * ================================================================ */
@@ -594,12 +1459,37 @@ static int is_keyboard(int fd)
     return TEST_BIT(KEY_Q, keybits) && TEST_BIT(KEY_A, keybits);
 }
 
-static int scan_keyboards(int *fds, int max_fds)
+static int is_event_node(const char *node)
+{
+    return strlen(node) > 5 && strncmp(node, "event", 5) == 0;
+}
+
+/* Open /dev/input/<node> and return its fd if it is a keyboard */
+static int open_keyboard(const char *node)
 {
-    DIR *dir;
-    struct dirent *entry;
     char path[MAX_PATH_LEN];
     char name[MAX_NAME_LEN];
+
+    snprintf(path, sizeof(path), "/dev/input/%s", node);
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    if (!is_keyboard(fd)) {
+        close(fd);
+        return -1;
+    }
+    memset(name, 0, sizeof(name));
+    if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) < 0)
+        strcpy(name, "Unknown");
+    fprintf(stderr, "Found keyboard: %s (%s)\n", name, path);
+    return fd;
+}
+
+/* nodes may be NULL when the caller does not track hotplug */
+static int scan_keyboards(int *fds, char (*nodes)[KBD_NODE_LEN], int max_fds)
+{
+    DIR *dir;
+    struct dirent *entry;
     int count = 0;
 
     dir = opendir("/dev/input");
@@ -607,45 +1497,145 @@ static int scan_keyboards(int *fds, int max_fds)
 
     while ((entry = readdir(dir)) != NULL) {
         if (count >= max_fds) break;
-        if (strlen(entry->d_name) <= 5) continue;
-        if (strncmp(entry->d_name, "event", 5) != 0) continue;
+        if (!is_event_node(entry->d_name)) continue;
 
-        snprintf(path, sizeof(path), "/dev/input/%s", entry->d_name);
-        int fd = open(path, O_RDONLY | O_NONBLOCK);
+        int fd = open_keyboard(entry->d_name);
         if (fd < 0) continue;
-
-        if (is_keyboard(fd)) {
-            memset(name, 0, sizeof(name));
-            if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) < 0)
-                strcpy(name, "Unknown");
-            fprintf(stderr, "Found keyboard: %s (%s)\n", name, path);
-            fds[count++] = fd;
-        } else {
-            close(fd);
-        }
+        if (nodes)
+            snprintf(nodes[count], KBD_NODE_LEN, "%.*s",
+                     KBD_NODE_LEN - 1, entry->d_name);
+        fds[count++] = fd;
     }
     closedir(dir);
     return count;
 }
 
-static int read_keyboard_press(int *fds, int count)
+/* Open /dev/input/<node> and return its fd if it is a joystick: X/Y
+ * axes and BTN_TRIGGER. Our own virtual joysticks carry the real
+ * THEJOYSTICK's name, so a device by that name only counts when it
+ * has a physical path (uinput devices have none). */
+static int open_joystick(const char *node)
 {
-    struct input_event ev;
-    for (int i = 0; i < count; i++) {
-        while (read(fds[i], &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
-            if (ev.type == EV_KEY && ev.value == 1)
-                return ev.code;
-        }
+    char path[MAX_PATH_LEN];
+    char name[MAX_NAME_LEN];
+    char phys[MAX_NAME_LEN];
+    unsigned long evbits[NBITS(EV_MAX)];
+    unsigned long absbits[NBITS(ABS_MAX)];
+    unsigned long keybits[NBITS(KEY_MAX)];
+
+    snprintf(path, sizeof(path), "/dev/input/%s", node);
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    memset(evbits, 0, sizeof(evbits));
+    memset(absbits, 0, sizeof(absbits));
+    memset(keybits, 0, sizeof(keybits));
+    ioctl(fd, EVIOCGBIT(0, sizeof(evbits)), evbits);
+    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits);
+    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits);
+    if (!TEST_BIT(EV_ABS, evbits) || !TEST_BIT(EV_KEY, evbits) ||
+        !TEST_BIT(ABS_X, absbits) || !TEST_BIT(ABS_Y, absbits) ||
+        !TEST_BIT(BTN_TRIGGER, keybits)) {
+        close(fd);
+        return -1;
     }
-    return 0;
+
+    memset(name, 0, sizeof(name));
+    memset(phys, 0, sizeof(phys));
+    ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+    ioctl(fd, EVIOCGPHYS(sizeof(phys) - 1), phys);
+    if (strcmp(name, VDEV_NAME) == 0 && phys[0] == '\0') {
+        close(fd);
+        return -1;
+    }
+    fprintf(stderr, "Found joystick: %s (%s)\n", name, path);
+    return fd;
 }
 
-static void drain_keyboard_events(int *fds, int count)
+/* First joystick under /dev/input; its node name goes to node unless
+ * that is NULL */
+static int scan_joystick(char node[KBD_NODE_LEN])
 {
-    struct input_event ev;
-    for (int i = 0; i < count; i++)
-        while (read(fds[i], &ev, sizeof(ev)) == (ssize_t)sizeof(ev))
+    DIR *dir = opendir("/dev/input");
+    struct dirent *entry;
+    int fd = -1;
+
+    if (!dir) return -1;
+    while (fd < 0 && (entry = readdir(dir)) != NULL) {
+        if (!is_event_node(entry->d_name)) continue;
+        fd = open_joystick(entry->d_name);
+        if (fd >= 0 && node)
+            snprintf(node, KBD_NODE_LEN, "%.*s", KBD_NODE_LEN - 1, entry->d_name);
+    }
+    closedir(dir);
+    return fd;
+}
+
+/* Keyboard input is read EV_BATCH events per read() into a per-fd
+ * buffer and handed out one at a time by ev_next(). evdev returns as
+ * many whole events as are queued, so a short read means the queue is
+ * empty and the EAGAIN read that would normally end the loop can be
+ * skipped: the epoll loop is level-triggered and reports anything
+ * that arrives later. */
+#define EV_BATCH 64
+
+typedef struct {
+    struct input_event ev[EV_BATCH];
+    int head, len;
+    int drained;          /* last read was short, next call returns 0 */
+    clockid_t clock;      /* --latency: clock of the device's timestamps */
+} EvReader;
+
+static EvReader g_kbd_rd[MAX_KEYBOARDS];   /* one per g_kbd_fds slot */
+
+/* Point *ev at the next event from fd. Returns 1, 0 when nothing is
+ * pending, or -1 on a read error (errno set). */
+static int ev_next(EvReader *rd, int fd, const struct input_event **ev)
+{
+    if (rd->head == rd->len) {
+        if (rd->drained) {
+            rd->drained = 0;
+            return 0;
+        }
+        ssize_t n = read(fd, rd->ev, sizeof(rd->ev));
+        if (n < 0)
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        rd->head = 0;
+        rd->len  = (int)(n / (ssize_t)sizeof(rd->ev[0]));
+        rd->drained = rd->len < EV_BATCH;
+        if (rd->len == 0) {
+            rd->drained = 0;
+            return 0;
+        }
+    }
+    *ev = &rd->ev[rd->head++];
+    return 1;
+}
+
+#ifndef K2J_NO_GUIMAP
+/* First key press on any of fds, 0 if none. Events after it stay
+ * buffered in rd[] for the next call. */
+static int read_keyboard_press(EvReader *rd, const int *fds, int count)
+{
+    const struct input_event *ev;
+    for (int i = 0; i < count; i++) {
+        while (ev_next(&rd[i], fds[i], &ev) > 0) {
+            if (ev->type == EV_KEY && ev->value == 1)
+                return ev->code;
+        }
+    }
+    return 0;
+}
+#endif
+
+static void drain_keyboard_events(EvReader *rd, const int *fds, int count)
+{
+    struct input_event buf[EV_BATCH];
+    for (int i = 0; i < count; i++) {
+        rd[i].head = rd[i].len = rd[i].drained = 0;
+        while (read(fds[i], buf, sizeof(buf)) == (ssize_t)sizeof(buf))
             ;
+    }
 }
 
 /* ================================================================
@@ -659,7 +1649,7 @@ static int create_virtual_joystick(void)
     int axes[] = { ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY };
     int i;
 
-    fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
     if (fd < 0) {
         perror("open /dev/uinput");
         fprintf(stderr, "Hint: try 'modprobe uinput' or check permissions\n");
@@ -709,9 +1699,9 @@ static int create_virtual_joystick(void)
 
     /* Set initial axis positions to center */
     for (i = 0; i < 5; i++) {
-        emit_event(fd, EV_ABS, axes[i], AXIS_CENTER);
+        emit_event(EV_ABS, axes[i], AXIS_CENTER);
     }
-    emit_syn(fd);
+    emit_flush(fd);
 
     fprintf(stderr, "Virtual THEJOYSTICK created: %s\n", VDEV_NAME);
     return fd;
@@ -722,6 +1712,161 @@ fail:
     return -1;
 }
 
+/* Find the evdev node the kernel attached to our uinput device
+ * ("event7") via its sysfs name. Returns 0 on success. */
+static int virtual_joystick_node(int fd, char *node, size_t len)
+{
+    char sysname[64];
+    char path[MAX_PATH_LEN];
+    DIR *dir;
+    struct dirent *entry;
+    int found = -1;
+
+    memset(sysname, 0, sizeof(sysname));
+    if (ioctl(fd, UI_GET_SYSNAME(sizeof(sysname) - 1), sysname) < 0)
+        return -1;
+    snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+    dir = opendir(path);
+    if (!dir) return -1;
+    while ((entry = readdir(dir)) != NULL) {
+        if (is_event_node(entry->d_name)) {
+            snprintf(node, len, "%.*s", (int)len - 1, entry->d_name);
+            found = 0;
+            break;
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+/* Wait until /dev/input/<our node> exists, so whatever starts after us
+ * (the64) sees the joystick immediately. Uses inotify with a bounded
+ * timeout; kernels without UI_GET_SYSNAME fall back to a fixed delay. */
+static void wait_for_devnode(int fd)
+{
+    char node[KBD_NODE_LEN];
+    char path[MAX_PATH_LEN];
+    uint64_t deadline = time_ms() + DEVNODE_WAIT_MS;
+
+    if (virtual_joystick_node(fd, node, sizeof(node)) < 0) {
+        usleep(500000);
+        return;
+    }
+    snprintf(path, sizeof(path), "/dev/input/%s", node);
+
+    int ifd = inotify_init1(IN_CLOEXEC);
+    if (ifd >= 0 && inotify_add_watch(ifd, "/dev/input", IN_CREATE | IN_ATTRIB) < 0) {
+        close(ifd);
+        ifd = -1;
+    }
+
+    /* Check after the watch is in place so creation cannot be missed */
+    while (access(path, R_OK) != 0) {
+        uint64_t now = time_ms();
+        if (now >= deadline) {
+            fprintf(stderr, "Warning: %s did not appear within %d ms\n",
+                    path, DEVNODE_WAIT_MS);
+            break;
+        }
+        if (ifd < 0) {
+            usleep(10000);
+            continue;
+        }
+        struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+        char buf[1024];
+        if (poll(&pfd, 1, (int)(deadline - now)) > 0)
+            if (read(ifd, buf, sizeof(buf)) < 0) break;
+    }
+    if (ifd >= 0) close(ifd);
+}
+
+/* --daemon: detach once the joystick exists; the parent's exit tells
+ * start.sh it can launch the64 */
+static int daemonize(void)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid > 0)
+        _exit(0);
+    setsid();
+    int nul = open("/dev/null", O_RDONLY);
+    if (nul >= 0) {
+        dup2(nul, STDIN_FILENO);
+        close(nul);
+    }
+    return 0;
+}
+
+/* ================================================================
+ * Real-time scheduling (--realtime, --cpu)
+ *
+ * The translator does almost no work per event, but under the default
+ * scheduler it waits behind the64's emulation and render threads.
+ * --realtime runs the translation thread SCHED_FIFO at a modest
+ * priority (the remap GUI thread keeps normal scheduling), so it preempts
+ * them only for the few microseconds a frame takes, and locks its
+ * pages so a key press never waits on a page fault. Each step falls
+ * back quietly (with a warning) when privileges or limits say no.
+ * ================================================================ */
+
+#define RT_DEFAULT_PRIO  10
+
+static int g_rt_prio;               /* --realtime [PRIO], 0 = off */
+static int g_rt_cpu = -1;           /* --cpu N, -1 = not pinned */
+static cpu_set_t g_all_cpus;        /* affinity before --cpu, for the64 */
+static int g_rt_pinned;
+static int g_rt_niced;              /* fell back to nice -10 */
+
+static void realtime_init(void)
+{
+    if (g_rt_cpu >= 0) {
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(g_rt_cpu, &one);
+        if (sched_getaffinity(0, sizeof(g_all_cpus), &g_all_cpus) == 0 &&
+            sched_setaffinity(0, sizeof(one), &one) == 0) {
+            g_rt_pinned = 1;
+            fprintf(stderr, "Pinned to CPU %d\n", g_rt_cpu);
+        } else {
+            fprintf(stderr, "Warning: cannot pin to CPU %d: %s\n",
+                    g_rt_cpu, strerror(errno));
+        }
+    }
+    if (!g_rt_prio)
+        return;
+
+    /* RESET_ON_FORK: the64 and anything else we spawn start as normal
+     * SCHED_OTHER processes */
+    struct sched_param sp = { .sched_priority = g_rt_prio };
+    if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &sp) == 0) {
+        fprintf(stderr, "Running SCHED_FIFO priority %d\n", g_rt_prio);
+    } else {
+        fprintf(stderr, "Warning: SCHED_FIFO unavailable (%s), "
+                "raising nice level instead\n", strerror(errno));
+        if (setpriority(PRIO_PROCESS, 0, -10) == 0)
+            g_rt_niced = 1;
+        else
+            fprintf(stderr, "Warning: cannot raise priority: %s\n",
+                    strerror(errno));
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0 &&
+        mlockall(MCL_CURRENT) < 0)
+        fprintf(stderr, "Warning: mlockall: %s\n", strerror(errno));
+}
+
+/* A child inherits our --cpu pinning and, unlike SCHED_FIFO, the nice
+ * fallback; give it the CPUs we started with and normal priority */
+static void realtime_release_child(pid_t pid)
+{
+    if (g_rt_pinned)
+        sched_setaffinity(pid, sizeof(g_all_cpus), &g_all_cpus);
+    if (g_rt_niced)
+        setpriority(PRIO_PROCESS, (id_t)pid, 0);
+}
+
 static void destroy_virtual_joystick(int fd)
 {
     if (fd >= 0) {
@@ -734,455 +1879,2771 @@ static void destroy_virtual_joystick(int fd)
  * Event emission
  * ================================================================ */
 
-static void emit_event(int fd, int type, int code, int value)
+/* Events are queued into one frame and written to uinput with a single
+ * write() by emit_flush(), which terminates the frame with SYN_REPORT. */
+
+static void emit_write(int fd, int count)
 {
-    struct input_event ev;
-    memset(&ev, 0, sizeof(ev));
-    ev.type  = type;
-    ev.code  = code;
-    ev.value = value;
-    if (write(fd, &ev, sizeof(ev)) < 0)
-        perror("emit_event write");
+    if (fd < 0) {
+        g_player->lat_npending = 0;
+        return;
+    }
+    if (write(fd, g_player->frame, count * sizeof(g_player->frame[0])) < 0) {
+        /* Only the first failure is printed; the rest are counted */
+        if (STAT_ADD(write_errors, 1) == 0)
+            perror("emit_event write");
+        g_player->lat_npending = 0;   /* nothing reached uinput */
+        return;
+    }
+    STAT_ADD(frames_out, 1);
+    STAT_ADD(events_out, count);
+    if (g_player->lat_npending)
+        latency_record();
 }
 
-static void emit_syn(int fd)
+/* Queue an event on the current player's frame */
+static void emit_event(int type, int code, int value)
 {
-    emit_event(fd, EV_SYN, SYN_REPORT, 0);
+    Player *pl = g_player;
+
+    /* Leave room for the SYN_REPORT appended by emit_flush() */
+    if (pl->frame_len >= MAX_FRAME_EVENTS - 1) {
+        emit_write(pl->uinput_fd, pl->frame_len);
+        pl->frame_len = 0;
+    }
+    struct input_event *ev = &pl->frame[pl->frame_len++];
+    memset(ev, 0, sizeof(*ev));
+    ev->type  = type;
+    ev->code  = code;
+    ev->value = value;
 }
 
-static void recalc_and_emit_axes(void)
+static void emit_flush(int fd)
+{
+    if (g_player->frame_len == 0) return;
+    emit_event(EV_SYN, SYN_REPORT, 0);
+    emit_write(fd, g_player->frame_len);
+    g_player->frame_len = 0;
+}
+
+/* Set the buttons source (&btn_kbd, &btn_macro or &btn_joy) holds
+ * to held, queueing whatever that changes in the combined output */
+static void buttons_set(uint16_t *source, unsigned held)
+{
+    Player *pl = g_player;
+    unsigned before = pl->btn_kbd | pl->btn_macro | pl->btn_joy;
+
+    *source = (uint16_t)held;
+    unsigned after = pl->btn_kbd | pl->btn_macro | pl->btn_joy;
+    for (unsigned m = before ^ after; m; m &= m - 1) {
+        int b = __builtin_ctz(m);
+        emit_event(EV_MSC, MSC_SCAN, 0x90001 + b);
+        emit_event(EV_KEY, BTN_TRIGGER + b, (after >> b) & 1);
+    }
+}
+
+static void button_set(uint16_t *source, int code, int value)
+{
+    unsigned bit = 1u << ((code - BTN_TRIGGER) & 15);
+    buttons_set(source, value ? *source | bit : *source & ~bit);
+}
+
+static void emit_button(int b, int value)
+{
+    button_set(&g_player->btn_kbd, g_player->map[b].btn_code, value);
+}
+
+/* Queue release of everything the keys and macros hold, dropping any
+ * turbo or macro in progress; the stick is re-centred (or handed to
+ * the merged joystick) by the next translate_flush() */
+static void emit_release_all(void)
+{
+    Player *pl = g_player;
+
+    pl->turbo_held = pl->turbo_on = 0;
+    pl->macro_active = 0;
+    buttons_set(&pl->btn_kbd, 0);
+    buttons_set(&pl->btn_macro, 0);
+    pl->macro_axis[0] = pl->macro_axis[1] = -1;
+    pl->dir_mask = 0;
+    pl->dir_order = 0;
+    pl->dir_order_len = 0;
+    pl->ramp_sign[0] = pl->ramp_sign[1] = 0;
+    pl->ramp_next = 0;
+    pl->axis_dirty = 1;
+}
+
+/* Keep dir_order in step with a direction mask change */
+static void dir_order_update(uint8_t old_mask, uint8_t new_mask)
+{
+    Player *pl = g_player;
+
+    for (unsigned m = old_mask & ~new_mask; m; m &= m - 1) {
+        unsigned d = __builtin_ctz(m);
+        for (int p = 0; p < pl->dir_order_len; p++) {
+            if (((pl->dir_order >> (4 * p)) & 0xF) != d) continue;
+            uint32_t low = pl->dir_order & ((1u << (4 * p)) - 1);
+            pl->dir_order = low | ((pl->dir_order >> 4) & ~((1u << (4 * p)) - 1));
+            pl->dir_order_len--;
+            break;
+        }
+    }
+    for (unsigned m = new_mask & ~old_mask; m; m &= m - 1) {
+        if (pl->dir_order_len >= NUM_DIRECTIONS) break;
+        pl->dir_order |= (uint32_t)__builtin_ctz(m) << (4 * pl->dir_order_len);
+        pl->dir_order_len++;
+    }
+}
+
+/* Last/first-wins: each axis takes its value from the newest (oldest)
+ * held direction that moves along it, so Left held then Right gives
+ * Right at once rather than a centred frame. */
+static void socd_axes(uint8_t *axes)
 {
+    const Player *pl = g_player;
     int sx = 0, sy = 0;
-    int ax, ay;
+    int last = (g_socd == SOCD_LAST);
 
-    for (int d = 0; d < NUM_DIRECTIONS; d++) {
-        if (g_dir_held[d]) {
-            sx += g_map[d].dx;
-            sy += g_map[d].dy;
+    for (int i = 0; i < pl->dir_order_len && !(sx && sy); i++) {
+        int p = last ? pl->dir_order_len - 1 - i : i;
+        const Mapping *m = &pl->map[(pl->dir_order >> (4 * p)) & 0xF];
+        if (!sx) sx = m->dx;
+        if (!sy) sy = m->dy;
+    }
+    axes[0] = (uint8_t)axis_value(sx);
+    axes[1] = (uint8_t)axis_value(sy);
+}
+
+/* --ramp: rather than jumping to 0 or 255, an axis starts just past
+ * the flat zone and eases out to full deflection over g_ramp_ms while
+ * its direction stays held (quadratic, so taps give fine movement).
+ * While an axis is still ramping, ramp_next asks for another update. */
+static void ramp_axes(const uint8_t *target, uint8_t *out)
+{
+    Player *pl = g_player;
+    uint64_t now = time_ns();
+    uint64_t span_us = (uint64_t)g_ramp_ms * 1000;
+    int moving = 0;
+
+    for (int a = 0; a < 2; a++) {
+        int sign = (target[a] > AXIS_CENTER) - (target[a] < AXIS_CENTER);
+        if (sign != pl->ramp_sign[a]) {
+            pl->ramp_sign[a]  = sign;
+            pl->ramp_start[a] = now;
+        }
+        if (!sign) {
+            out[a] = AXIS_CENTER;
+            continue;
+        }
+        int range = sign > 0 ? AXIS_MAX - AXIS_CENTER : AXIS_CENTER - AXIS_MIN;
+        int off = range;
+        uint64_t t_us = (now - pl->ramp_start[a]) / 1000;
+        if (t_us < span_us) {
+            int start = AXIS_FLAT + 1;
+            off = start + (int)((uint64_t)(range - start) * t_us * t_us /
+                                (span_us * span_us));
+            moving = 1;
         }
+        out[a] = (uint8_t)(AXIS_CENTER + sign * off);
     }
+    if (!moving)
+        pl->ramp_next = 0;
+    else if (pl->ramp_next <= now)
+        pl->ramp_next = now + 1000000000ull / g_ramp_hz;
+}
 
-    if (sx < -1) sx = -1;
-    if (sx >  1) sx =  1;
-    if (sy < -1) sy = -1;
-    if (sy >  1) sy =  1;
+static void recalc_and_emit_axes(void)
+{
+    Player *pl = g_player;
+    uint8_t socd[2], ramp[2], out[2];
+    const uint8_t *axes = g_axis_lut[pl->dir_mask];
 
-    ax = (sx < 0) ? 0 : (sx > 0) ? 255 : 127;
-    ay = (sy < 0) ? 0 : (sy > 0) ? 255 : 127;
+    if (g_socd != SOCD_NEUTRAL) {
+        socd_axes(socd);
+        axes = socd;
+    }
+    if (g_ramp_ms) {
+        /* An axis a macro drives is at rest for the ramp, so the ramp
+         * starts over from the centre when the macro hands it back */
+        uint8_t target[2] = { axes[0], axes[1] };
+        for (int a = 0; a < 2; a++)
+            if (pl->macro_axis[a] >= 0)
+                target[a] = AXIS_CENTER;
+        ramp_axes(target, ramp);
+        axes = ramp;
+    }
+    for (int a = 0; a < 2; a++) {
+        /* Keys win over the merged stick, a playing macro over both */
+        out[a] = axes[a] != AXIS_CENTER ? axes[a] : pl->joy_axis[a];
+        if (pl->macro_axis[a] >= 0)
+            out[a] = (uint8_t)pl->macro_axis[a];
+    }
 
-    emit_event(g_uinput_fd, EV_ABS, ABS_X, ax);
-    emit_event(g_uinput_fd, EV_ABS, ABS_Y, ay);
-    emit_syn(g_uinput_fd);
+    if (out[0] != pl->axis_x) {
+        pl->axis_x = out[0];
+        emit_event(EV_ABS, ABS_X, pl->axis_x);
+    }
+    if (out[1] != pl->axis_y) {
+        pl->axis_y = out[1];
+        emit_event(EV_ABS, ABS_Y, pl->axis_y);
+    }
 }
 
 /* ================================================================
  * Keyboard grab / ungrab
  * ================================================================ */
 
-static void grab_keyboards(void)
+/* Ask the kernel to deliver only what translate_event() can act on:
+ * EV_SYN plus the EV_KEY codes bound in any player's mapping or macro
+ * and the Ctrl+S / Ctrl+R hotkeys. EV_MSC scancodes, LEDs and unbound
+ * keys then never wake the event loop (during a Ctrl+R remap every key
+ * is let through for the GUI). EVIOCSMASK is per open file,
+ * so it does not affect other readers; kernels without it (before
+ * 4.4) just keep delivering everything. */
+static void kbd_set_mask(int fd)
 {
-    for (int i = 0; i < g_num_kbd_fds; i++) {
-        if (ioctl(g_kbd_fds[i], EVIOCGRAB, 1) == 0) {
-            g_kbd_grabbed[i] = 1;
-            fprintf(stderr, "Grabbed keyboard fd %d\n", g_kbd_fds[i]);
-        } else {
-            g_kbd_grabbed[i] = 0;
-            fprintf(stderr, "Warning: failed to grab keyboard fd %d\n",
-                    g_kbd_fds[i]);
-        }
+#ifdef EVIOCSMASK
+    uint8_t types[(EV_CNT + 7) / 8] = {0};
+    uint8_t keys[(KEY_CNT + 7) / 8] = {0};
+    static const uint16_t hotkeys[] = {
+        KEY_LEFTCTRL, KEY_RIGHTCTRL, KEY_S, KEY_R,
+    };
+
+    types[EV_SYN / 8] |= 1u << (EV_SYN % 8);
+    types[EV_KEY / 8] |= 1u << (EV_KEY % 8);
+    /* The remap GUI takes any key */
+    if (__atomic_load_n(&g_remap_active, __ATOMIC_RELAXED))
+        memset(keys, 0xff, sizeof(keys));
+    for (size_t i = 0; i < sizeof(hotkeys) / sizeof(hotkeys[0]); i++)
+        keys[hotkeys[i] / 8] |= 1u << (hotkeys[i] % 8);
+    for (int p = 0; p < g_num_players; p++)
+        for (int code = 0; code < KEY_CNT; code++)
+            if (g_players[p].keymap[code] || g_players[p].macro_key[code])
+                keys[code / 8] |= 1u << (code % 8);
+
+    struct input_mask mask = { EV_SYN, sizeof(types),
+                               (uint64_t)(uintptr_t)types };
+    ioctl(fd, EVIOCSMASK, &mask);
+    mask = (struct input_mask){ EV_KEY, sizeof(keys),
+                                (uint64_t)(uintptr_t)keys };
+    ioctl(fd, EVIOCSMASK, &mask);
+#else
+    (void)fd;
+#endif
+}
+
+/* Refresh every keyboard's mask after the bound keys changed */
+static void kbd_mask_all(void)
+{
+    for (int i = 0; i < g_num_kbd_fds; i++)
+        kbd_set_mask(g_kbd_fds[i]);
+}
+
+/* Grab keyboard slot k and, while it is ours, turn its autorepeat off
+ * (a zero period stops the input core's repeat timer) so held keys
+ * produce no value-2 events at all. ungrab_keyboard() puts the old
+ * rate back for the console. */
+static void grab_keyboard(int k)
+{
+    int fd = g_kbd_fds[k];
+
+    kbd_set_mask(fd);
+    if (ioctl(fd, EVIOCGRAB, 1) < 0) {
+        STAT_ADD(grab_failures, 1);
+        g_kbd_grabbed[k] = 0;
+        fprintf(stderr, "Warning: failed to grab keyboard fd %d\n", fd);
+        return;
+    }
+    g_kbd_grabbed[k] = 1;
+    fprintf(stderr, "Grabbed keyboard fd %d\n", fd);
+
+    g_kbd_rep_off[k] = 0;
+    if (ioctl(fd, EVIOCGREP, g_kbd_rep[k]) == 0 && g_kbd_rep[k][1]) {
+        unsigned off[2] = { g_kbd_rep[k][0], 0 };
+        g_kbd_rep_off[k] = ioctl(fd, EVIOCSREP, off) == 0;
     }
 }
 
-static void ungrab_keyboards(void)
+static void ungrab_keyboard(int k)
 {
-    for (int i = 0; i < g_num_kbd_fds; i++) {
-        if (g_kbd_grabbed[i]) {
-            ioctl(g_kbd_fds[i], EVIOCGRAB, 0);
-            g_kbd_grabbed[i] = 0;
-        }
+    if (!g_kbd_grabbed[k]) return;
+    if (g_kbd_rep_off[k]) {
+        ioctl(g_kbd_fds[k], EVIOCSREP, g_kbd_rep[k]);
+        g_kbd_rep_off[k] = 0;
     }
+    ioctl(g_kbd_fds[k], EVIOCGRAB, 0);
+    g_kbd_grabbed[k] = 0;
 }
 
-/* ================================================================
- * Suspend translation (for live remap via Ctrl+R)
- * ================================================================ */
+static void grab_keyboards(void)
+{
+    for (int i = 0; i < g_num_kbd_fds; i++)
+        grab_keyboard(i);
+}
 
-static void suspend_translation(void)
+static void ungrab_keyboards(void)
 {
-    for (int b = NUM_DIRECTIONS; b < NUM_MAPPINGS; b++)
-        emit_event(g_uinput_fd, EV_KEY, g_map[b].btn_code, 0);
-    emit_event(g_uinput_fd, EV_ABS, ABS_X, AXIS_CENTER);
-    emit_event(g_uinput_fd, EV_ABS, ABS_Y, AXIS_CENTER);
-    emit_syn(g_uinput_fd);
-    ungrab_keyboards();
     for (int i = 0; i < g_num_kbd_fds; i++)
-        close(g_kbd_fds[i]);
-    g_num_kbd_fds = 0;
-    memset(g_dir_held, 0, sizeof(g_dir_held));
-    g_ctrl_held = 0;
-    g_suspended = 0;
+        ungrab_keyboard(i);
 }
 
 /* ================================================================
- * Cleanup (atexit safety net)
+ * Macros (--macro KEY:STEPS)
+ *
+ * A macro binds one key to a timed sequence of joystick states, e.g.
+ * "f1:menu1+menu2/100,_/50,leftfire/80": hold Menu 1 and Menu 2 for
+ * 100 ms, nothing for 50 ms, Left Fire for 80 ms, then release. At
+ * load time each sequence is compiled into a flat run of MacroEvent
+ * records holding only the changes between steps; playback walks the
+ * run from the event-loop timer, so other keys keep translating.
  * ================================================================ */
 
-static void cleanup(void)
-{
-    /* Release all held buttons */
-    if (g_uinput_fd >= 0) {
-        for (int b = NUM_DIRECTIONS; b < NUM_MAPPINGS; b++)
-            emit_event(g_uinput_fd, EV_KEY, g_map[b].btn_code, 0);
+#define MAX_MACRO_EVENTS  512
+#define MACRO_STEP_MS     50      /* step length when "/MS" is omitted */
+#define MACRO_MAX_MS      10000
 
-        /* Center axes */
-        emit_event(g_uinput_fd, EV_ABS, ABS_X, AXIS_CENTER);
-        emit_event(g_uinput_fd, EV_ABS, ABS_Y, AXIS_CENTER);
-        emit_syn(g_uinput_fd);
+typedef struct {
+    uint16_t delay_ms;   /* after the previous record */
+    uint16_t type;       /* EV_KEY or EV_ABS */
+    uint16_t code;
+    int16_t  value;
+} MacroEvent;
 
-        destroy_virtual_joystick(g_uinput_fd);
-        g_uinput_fd = -1;
+typedef struct {
+    const char *spec;    /* as given, for guimap_save_script() */
+    int         keycode;
+    int         start;   /* first record in g_macro_events[] */
+    int         count;
+} Macro;
+
+static MacroEvent g_macro_events[MAX_MACRO_EVENTS];
+static int g_num_macro_events;
+static Macro g_macros[MAX_MACROS];
+static int g_num_macros;
+
+static int macro_append(int *delay, int type, int code, int value)
+{
+    if (g_num_macro_events >= MAX_MACRO_EVENTS) {
+        fprintf(stderr, "Error: macros exceed %d events\n", MAX_MACRO_EVENTS);
+        return -1;
     }
+    g_macro_events[g_num_macro_events++] =
+        (MacroEvent){ (uint16_t)*delay, (uint16_t)type, (uint16_t)code,
+                      (int16_t)value };
+    *delay = 0;
+    return 0;
+}
 
-    ungrab_keyboards();
+/* Emit the records that take output mask cur to next (bits as in
+ * keymap: 0-7 directions, 8-15 buttons) */
+static int macro_compile_step(uint16_t *cur, uint16_t next, int *delay)
+{
+    int ox = 0, oy = 0, nx = 0, ny = 0;
 
-    for (int i = 0; i < g_num_kbd_fds; i++)
-        close(g_kbd_fds[i]);
-    g_num_kbd_fds = 0;
+    for (int d = 0; d < NUM_DIRECTIONS; d++) {
+        if (*cur & (1u << d)) { ox += g_player->map[d].dx; oy += g_player->map[d].dy; }
+        if (next & (1u << d)) { nx += g_player->map[d].dx; ny += g_player->map[d].dy; }
+    }
+    if (axis_value(ox) != axis_value(nx) &&
+        macro_append(delay, EV_ABS, ABS_X, axis_value(nx)) < 0)
+        return -1;
+    if (axis_value(oy) != axis_value(ny) &&
+        macro_append(delay, EV_ABS, ABS_Y, axis_value(ny)) < 0)
+        return -1;
+    for (int b = NUM_DIRECTIONS; b < NUM_MAPPINGS; b++) {
+        if (!((*cur ^ next) & (1u << b))) continue;
+        if (macro_append(delay, EV_KEY, g_player->map[b].btn_code,
+                         (next >> b) & 1) < 0)
+            return -1;
+    }
+    *cur = next;
+    return 0;
 }
 
-/* ================================================================
- * CLI parsing and help
- * ================================================================ */
+/* Compile spec into g_macros[] and bind its key for g_player only:
+ * the compiled records are shared, the key binding (macro_key) is per
+ * player, so "--player 2 --macro ..." gives player 2 the macro */
+static int macro_add(const char *spec)
+{
+    char buf[256], key[32];
+    char *save_step, *save_out;
+    const char *colon = strchr(spec, ':');
+    uint16_t cur = 0;
+    int delay = 0;
+
+    if (g_num_macros >= MAX_MACROS) {
+        fprintf(stderr, "Error: at most %d macros\n", MAX_MACROS);
+        return -1;
+    }
+    if (!colon || colon == spec || (size_t)(colon - spec) >= sizeof(key) ||
+        strlen(colon + 1) >= sizeof(buf)) {
+        fprintf(stderr, "Error: bad --macro '%s' (want KEY:STEPS)\n", spec);
+        return -1;
+    }
+    snprintf(key, sizeof(key), "%.*s", (int)(colon - spec), spec);
+    int kc = parse_keyname(key);
+    if (kc < 0) {
+        fprintf(stderr, "Error: unknown key name '%s'\n", key);
+        return -1;
+    }
+    snprintf(buf, sizeof(buf), "%s", colon + 1);
+
+    Macro *mc = &g_macros[g_num_macros];
+    mc->spec    = spec;
+    mc->keycode = kc;
+    mc->start   = g_num_macro_events;
+
+    for (char *step = strtok_r(buf, ",", &save_step); step;
+         step = strtok_r(NULL, ",", &save_step)) {
+        char *slash = strchr(step, '/');
+        int ms = MACRO_STEP_MS;
+        uint16_t next = 0;
+
+        if (slash) {
+            *slash = '\0';
+            ms = atoi(slash + 1);
+        }
+        if (ms < 1 || ms > MACRO_MAX_MS) {
+            fprintf(stderr, "Error: macro step '%s' needs 1-%d ms\n",
+                    step, MACRO_MAX_MS);
+            return -1;
+        }
+        if (strcmp(step, "_") != 0) {
+            for (char *out = strtok_r(step, "+", &save_out); out;
+                 out = strtok_r(NULL, "+", &save_out)) {
+                int m;
+                for (m = 0; m < NUM_MAPPINGS; m++)
+                    if (strcmp(out, g_player->map[m].cli_name + 2) == 0) break;
+                if (m == NUM_MAPPINGS) {
+                    fprintf(stderr, "Error: unknown macro output '%s'\n", out);
+                    return -1;
+                }
+                next |= (uint16_t)(1u << m);
+            }
+        }
+        if (macro_compile_step(&cur, next, &delay) < 0)
+            return -1;
+        if (delay + ms > 0xFFFF) {
+            fprintf(stderr, "Error: macro pause too long in '%s'\n", spec);
+            return -1;
+        }
+        delay += ms;
+    }
+    if (macro_compile_step(&cur, 0, &delay) < 0)
+        return -1;
 
-static void print_usage(void)
+    mc->count = g_num_macro_events - mc->start;
+    if (mc->count == 0) {
+        fprintf(stderr, "Error: macro '%s' does nothing\n", spec);
+        return -1;
+    }
+    g_player->macro_key[kc] = (uint8_t)(++g_num_macros);
+    return 0;
+}
+
+/* Play every record of the current player's macro i that is due by
+ * now. Delays are measured from when the previous record actually
+ * went out, so a late wakeup never shortens a hold the game needs to
+ * see. */
+static void macro_run(int i, uint64_t now)
 {
-    printf("keyboard2thejoystick - USB Keyboard to Virtual THEJOYSTICK\n\n");
-    printf("Creates a virtual THEJOYSTICK via Linux uinput, translating keyboard\n");
-    printf("input to joystick events for THEC64 Mini/Maxi.\n\n");
-    printf("Usage: keyboard2thejoystick [OPTIONS]\n\n");
+    Player *pl = g_player;
+    const Macro *mc = &g_macros[i];
 
-    printf("Direction keys:\n");
-    printf("  --up KEY         (current: %-14s)  --upleft KEY    (current: %s)\n",
-           keycode_to_name(g_map[0].keycode), keycode_to_name(g_map[4].keycode));
-    printf("  --down KEY       (current: %-14s)  --upright KEY   (current: %s)\n",
-           keycode_to_name(g_map[1].keycode), keycode_to_name(g_map[5].keycode));
-    printf("  --left KEY       (current: %-14s)  --downleft KEY  (current: %s)\n",
-           keycode_to_name(g_map[2].keycode), keycode_to_name(g_map[6].keycode));
-    printf("  --right KEY      (current: %-14s)  --downright KEY (current: %s)\n",
-           keycode_to_name(g_map[3].keycode), keycode_to_name(g_map[7].keycode));
-    printf("\n");
+    while (pl->macro_next[i] <= now) {
+        const MacroEvent *me = &g_macro_events[pl->macro_pos[i]];
 
-    printf("Button keys:\n");
-    printf("  --leftfire KEY   (current: %-14s)  --rightfire KEY (current: %s)\n",
-           keycode_to_name(g_map[8].keycode), keycode_to_name(g_map[9].keycode));
-    printf("  --lefttri KEY    (current: %-14s)  --righttri KEY  (current: %s)\n",
-           keycode_to_name(g_map[10].keycode), keycode_to_name(g_map[11].keycode));
-    printf("  --menu1 KEY      (current: %-14s)  --menu2 KEY     (current: %s)\n",
-           keycode_to_name(g_map[12].keycode), keycode_to_name(g_map[13].keycode));
-    printf("  --menu3 KEY      (current: %-14s)  --menu4 KEY     (current: %s)\n",
-           keycode_to_name(g_map[14].keycode), keycode_to_name(g_map[15].keycode));
-    printf("\n");
+        /* Played as its own output source, so held keys and the
+         * merged joystick are neither overwritten nor released */
+        if (me->type == EV_KEY) {
+            button_set(&pl->btn_macro, me->code, me->value);
+        } else {
+            pl->macro_axis[me->code == ABS_Y] = me->value;
+            pl->axis_dirty = 1;
+        }
 
-    printf("Other:\n");
-    printf("  --help           Show this help with current configuration\n");
-    printf("  --guimap         Interactive framebuffer mapping mode\n");
-    printf("\n");
+        if (++pl->macro_pos[i] == mc->start + mc->count) {
+            /* Done: hand the stick back to the held keys */
+            pl->macro_active &= ~(1u << i);
+            if (!pl->macro_active) {
+                pl->macro_axis[0] = pl->macro_axis[1] = -1;
+                pl->axis_dirty = 1;
+            }
+            return;
+        }
+        uint64_t d = g_macro_events[pl->macro_pos[i]].delay_ms * 1000000ull;
+        if (d)
+            pl->macro_next[i] = (pl->macro_next[i] + d > now)
+                                ? pl->macro_next[i] + d : now + d;
+    }
+}
 
-    printf("Key names: single chars (a, 7), or names (space, lalt, lctrl,\n");
-    printf("  lshift, rshift, tab, enter, esc, bracketleft, bracketright,\n");
-    printf("  f1-f12, up, down, left, right, etc.)\n");
-    printf("\n");
+/* A macro key was pressed; pressing it again mid-playback is ignored.
+ * The first record's delay is a leading "_/N" pause, if any. */
+static void macro_start(int i, uint64_t now)
+{
+    Player *pl = g_player;
+    uint64_t d = g_macro_events[g_macros[i].start].delay_ms * 1000000ull;
+
+    if (pl->macro_active & (1u << i)) return;
+    pl->macro_active |= (uint16_t)(1u << i);
+    pl->macro_pos[i]  = g_macros[i].start;
+    pl->macro_next[i] = now + d;
+    if (!d)
+        macro_run(i, now);
+}
 
-    printf("Direction layout (QWEASDZXC):\n");
-    printf("  Q=Up-Left    W=Up      E=Up-Right\n");
-    printf("  A=Left       (S=n/a)   D=Right\n");
-    printf("  Z=Down-Left  X=Down    C=Down-Right\n");
+static uint64_t macro_deadline(void)
+{
+    const Player *pl = g_player;
+    uint64_t next = 0;
+
+    for (unsigned m = pl->macro_active; m; m &= m - 1) {
+        int i = __builtin_ctz(m);
+        if (!next || pl->macro_next[i] < next)
+            next = pl->macro_next[i];
+    }
+    return next;
 }
 
-static int parse_args(int argc, char **argv, int *help, int *guimap)
+static void macro_tick(uint64_t now)
 {
-    *help = 0;
-    *guimap = 0;
+    for (unsigned m = g_player->macro_active; m; m &= m - 1)
+        macro_run(__builtin_ctz(m), now);
+}
 
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
-            *help = 1;
-            continue;
-        }
-        if (strcmp(argv[i], "--guimap") == 0) {
+/* ================================================================
+ * Translation core
+ *
+ * Pure keyboard-event -> joystick-frame logic with no fd I/O of its
+ * own: output is queued by emit_event() and flushed to each player's
+ * uinput_fd (discarded when that is -1, as in --bench). Hotkeys that
+ * need device I/O are reported back to the caller.
+ * ================================================================ */
+
+#define TR_NONE      0
+#define TR_SUSPEND   1   /* Ctrl+S: emulation paused, ungrab keyboards */
+#define TR_RESUME    2   /* Ctrl+S again: re-grab keyboards */
+#define TR_REMAP     3   /* Ctrl+R: enter the remap GUI */
+
+static uint64_t g_frames_out;  /* uinput frames flushed by the core */
+
+/* Recompute axes if needed and send every player's pending frame */
+static void translate_flush(void)
+{
+    Player *cur = g_player;
+
+    for (int p = 0; p < g_num_players; p++) {
+        Player *pl = g_player = &g_players[p];
+        if (pl->axis_dirty)
+            recalc_and_emit_axes();
+        pl->axis_dirty = 0;
+        if (pl->frame_len) {
+            emit_flush(pl->uinput_fd);
+            g_frames_out++;
+        } else {
+            pl->lat_npending = 0;   /* its input changed nothing */
+        }
+    }
+    g_player = cur;
+}
+
+/* Queue a full release on every player (pause, remap, mapping swap) */
+static void translate_release_all(void)
+{
+    Player *cur = g_player;
+
+    for (int p = 0; p < g_num_players; p++) {
+        g_player = &g_players[p];
+        emit_release_all();
+    }
+    g_player = cur;
+}
+
+/* Apply a mapped key to the current player; returns 0 if the player
+ * has nothing bound to it */
+static int translate_key(const struct input_event *ev, int pressed)
+{
+    Player *pl = g_player;
+
+    if (pl->macro_key[ev->code]) {
+        if (pressed)
+            macro_start(pl->macro_key[ev->code] - 1, time_ns());
+        return 1;
+    }
+
+    unsigned outs = pl->keymap[ev->code];
+    if (!outs) return 0;
+
+    /* Direction outputs (bits 0-7) */
+    uint8_t dirs = outs & 0xFF;
+    if (dirs) {
+        uint8_t mask = pressed ? (pl->dir_mask | dirs) : (pl->dir_mask & ~dirs);
+        if (mask != pl->dir_mask) {
+            if (g_socd != SOCD_NEUTRAL)
+                dir_order_update(pl->dir_mask, mask);
+            pl->dir_mask = mask;
+            pl->axis_dirty = 1;
+        }
+    }
+
+    /* Button outputs (bits 8-15) */
+    for (unsigned m = outs >> NUM_DIRECTIONS; m; m &= m - 1) {
+        int b = NUM_DIRECTIONS + __builtin_ctz(m);
+        if (pl->map[b].turbo_hz) {
+            uint16_t bit = (uint16_t)(1u << b);
+            if (pressed) {
+                pl->turbo_held |= bit;
+                pl->turbo_on   |= bit;
+                pl->turbo_next[b] = time_ns() + 500000000ull / pl->map[b].turbo_hz;
+            } else {
+                pl->turbo_held &= ~bit;
+                pl->turbo_on   &= ~bit;
+            }
+        }
+        emit_button(b, pressed);
+    }
+    return 1;
+}
+
+/* Translate one keyboard event for the players in the players mask:
+ * one bit normally, all of them with --split. */
+static int translate_event(const struct input_event *ev, unsigned players)
+{
+    /* End of a keyboard frame: send everything it produced to uinput
+     * as one frame */
+    if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+        translate_flush();
+        return TR_NONE;
+    }
+    if (ev->type != EV_KEY || ev->code >= KEY_CNT) return TR_NONE;
+    if (ev->value == 2) return TR_NONE;  /* skip autorepeat */
+
+    int pressed = (ev->value == 1);
+
+    /* Track Ctrl key state */
+    if (ev->code == KEY_LEFTCTRL || ev->code == KEY_RIGHTCTRL) {
+        g_ctrl_held = pressed;
+        return TR_NONE;
+    }
+
+    /* Ctrl+S → toggle suspend/resume */
+    if (ev->code == KEY_S && pressed && g_ctrl_held) {
+        if (!g_suspended) {
+            translate_release_all();
+            translate_flush();
+            g_suspended = 1;
+            return TR_SUSPEND;
+        }
+        g_suspended = 0;
+        g_ctrl_held = 0;
+        return TR_RESUME;
+    }
+
+    /* Ctrl+R → request remap; remap_begin() ends a pause */
+    if (ev->code == KEY_R && pressed && g_ctrl_held)
+        return TR_REMAP;
+
+    if (g_suspended) return TR_NONE;
+
+    Player *cur = g_player;
+    for (unsigned m = players; m; m &= m - 1) {
+        g_player = &g_players[__builtin_ctz(m)];
+        if (translate_key(ev, pressed) && g_latency)
+            latency_mark(ev);
+    }
+    g_player = cur;
+    return TR_NONE;
+}
+
+/* Earliest pending turbo toggle of the current player, 0 if no turbo
+ * button is held */
+static uint64_t turbo_deadline(void)
+{
+    const Player *pl = g_player;
+    uint64_t next = 0;
+
+    for (unsigned m = pl->turbo_held; m; m &= m - 1) {
+        int b = __builtin_ctz(m);
+        if (!next || pl->turbo_next[b] < next)
+            next = pl->turbo_next[b];
+    }
+    return next;
+}
+
+/* Toggle every held turbo button that is due; the caller flushes so
+ * simultaneous toggles go out as one frame. A late wakeup drops the
+ * missed toggles instead of bursting them out. */
+static void turbo_tick(uint64_t now)
+{
+    Player *pl = g_player;
+
+    for (unsigned m = pl->turbo_held; m; m &= m - 1) {
+        int b = __builtin_ctz(m);
+        if (pl->turbo_next[b] > now) continue;
+
+        uint64_t half = 500000000ull / pl->map[b].turbo_hz;
+        pl->turbo_next[b] += half;
+        if (pl->turbo_next[b] <= now)
+            pl->turbo_next[b] = now + half;
+        pl->turbo_on ^= (uint16_t)(1u << b);
+        emit_button(b, (pl->turbo_on >> b) & 1);
+    }
+}
+
+static uint64_t earliest(uint64_t a, uint64_t b)
+{
+    return (!a || (b && b < a)) ? b : a;
+}
+
+/* Earliest time-driven output (turbo toggle, macro step or ramp
+ * update) of any player, 0 if none */
+static uint64_t translate_deadline(void)
+{
+    Player *cur = g_player;
+    uint64_t next = 0;
+
+    for (int p = 0; p < g_num_players; p++) {
+        g_player = &g_players[p];
+        next = earliest(next, earliest(turbo_deadline(), macro_deadline()));
+        next = earliest(next, g_player->ramp_next);
+    }
+    g_player = cur;
+    return next;
+}
+
+/* The timer fired: run whatever is due and send it out */
+static void translate_tick(uint64_t now)
+{
+    Player *cur = g_player;
+
+    for (int p = 0; p < g_num_players; p++) {
+        g_player = &g_players[p];
+        turbo_tick(now);
+        macro_tick(now);
+        if (g_player->ramp_next && g_player->ramp_next <= now)
+            g_player->axis_dirty = 1;
+    }
+    g_player = cur;
+    translate_flush();
+}
+
+/* ================================================================
+ * Input traces (--record / --bench)
+ *
+ * A trace is a TraceHeader followed by raw struct input_event records
+ * exactly as read from the keyboards. The event layout is ABI
+ * specific, so the header stores its size and --bench refuses traces
+ * recorded on a different ABI.
+ * ================================================================ */
+
+#define TRACE_MAGIC       "K2JTRACE"
+#define TRACE_VERSION     1
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t event_size;
+} TraceHeader;
+
+static int g_daemon;                /* --daemon */
+static int g_show_stats;            /* --stats */
+static const char *g_config_path;   /* --config FILE, reloaded on SIGHUP */
+static int g_config_player;         /* player it was given for */
+static Mapping g_config_base[NUM_MAPPINGS];  /* its mapping before FILE */
+static char **g_config_args;        /* command line after --config FILE */
+static int g_config_nargs;
+static const char *g_record_path;   /* --record FILE */
+static FILE *g_record_fp;
+static const char *g_bench_path;    /* --bench FILE */
+static long g_bench_loops = 100;    /* --bench-loops N */
+
+static int record_open(const char *path)
+{
+    TraceHeader h;
+
+    g_record_fp = fopen(path, "wb");
+    if (!g_record_fp) {
+        perror("fopen record");
+        return -1;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    h.version    = TRACE_VERSION;
+    h.event_size = sizeof(struct input_event);
+    fwrite(&h, sizeof(h), 1, g_record_fp);
+    fprintf(stderr, "Recording input trace to %s\n", path);
+    return 0;
+}
+
+static void record_event(const struct input_event *ev)
+{
+    fwrite(ev, sizeof(*ev), 1, g_record_fp);
+}
+
+static void record_close(void)
+{
+    if (g_record_fp) fclose(g_record_fp);
+    g_record_fp = NULL;
+}
+
+/* Replay a trace through translate_event() with output discarded and
+ * report throughput; no keyboards or /dev/uinput needed. */
+static int bench_run(const char *path, long loops)
+{
+    FILE *fp = fopen(path, "rb");
+    TraceHeader h;
+    struct input_event *evs;
+    long nev;
+
+    if (!fp) { perror("fopen bench"); return 1; }
+    if (fread(&h, sizeof(h), 1, fp) != 1 ||
+        memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != TRACE_VERSION) {
+        fprintf(stderr, "Error: %s is not an input trace\n", path);
+        fclose(fp);
+        return 1;
+    }
+    if (h.event_size != sizeof(struct input_event)) {
+        fprintf(stderr, "Error: trace uses %u-byte events, this build %zu\n",
+                h.event_size, sizeof(struct input_event));
+        fclose(fp);
+        return 1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    nev = (ftell(fp) - (long)sizeof(h)) / (long)sizeof(*evs);
+    fseek(fp, sizeof(h), SEEK_SET);
+    if (nev <= 0) {
+        fprintf(stderr, "Error: %s contains no events\n", path);
+        fclose(fp);
+        return 1;
+    }
+    evs = malloc(nev * sizeof(*evs));
+    if (!evs || fread(evs, sizeof(*evs), nev, fp) != (size_t)nev) {
+        fprintf(stderr, "Error: failed to read %s\n", path);
+        free(evs);
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+
+    /* Traces do not say which keyboard an event came from: replay them
+     * as the first keyboard (player 1, or everyone with --split) */
+    unsigned players = g_split ? ALL_PLAYERS : 1;
+    g_frames_out = 0;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long l = 0; l < loops; l++)
+        for (long i = 0; i < nev; i++)
+            translate_event(&evs[i], players);
+    translate_flush();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    double total = (double)nev * loops;
+    printf("Replayed %ld events x %ld loops in %.3f s\n", nev, loops, secs);
+    printf("  %.0f events/sec, %.1f ns/event, %llu frames emitted\n",
+           total / secs, secs * 1e9 / total, (unsigned long long)g_frames_out);
+    free(evs);
+    return 0;
+}
+
+/* ================================================================
+ * Profile store (--profiles / --profile / --save-profile)
+ *
+ * A fixed-layout file of named mappings: a ProfileHeader followed by
+ * count ProfileRecords, each holding one keycode per Mapping entry in
+ * Player.map order. The file is mmapped read-only and a profile is applied
+ * by copying keycodes, with no string parsing. Native byte order
+ * (little-endian on both the ARM target and x86 hosts).
+ * ================================================================ */
+
+#define PROFILE_MAGIC     "K2JPROFL"
+#define PROFILE_VERSION   1
+#define PROFILE_NAME_LEN  32
+#define MAX_PROFILES      256
+#define PROFILES_DEFAULT  "keyboard2thejoystick.profiles"
+#define MAX_GAME_DIRS     4
+#define TURBO_DEFAULT_HZ  10
+#define TURBO_MAX_HZ      30
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t count;
+} ProfileHeader;
+
+typedef struct {
+    char     name[PROFILE_NAME_LEN];    /* NUL padded */
+    uint16_t keycode[NUM_MAPPINGS];     /* 0 = leave unchanged */
+} ProfileRecord;
+
+static const char *g_profiles_path = PROFILES_DEFAULT;  /* --profiles FILE */
+static const char *g_save_profile;                      /* --save-profile */
+static const char *g_game_dirs[MAX_GAME_DIRS];          /* --game-dir DIR */
+static int g_num_game_dirs;
+static const ProfileRecord *g_profiles;
+static uint32_t g_num_profiles;
+static void *g_profiles_map;
+static size_t g_profiles_map_size;
+
+static void profiles_unload(void)
+{
+    if (g_profiles_map) munmap(g_profiles_map, g_profiles_map_size);
+    g_profiles_map = NULL;
+    g_profiles = NULL;
+    g_num_profiles = 0;
+}
+
+/* Map the store at path. A missing file is an empty store. */
+static int profiles_load(const char *path)
+{
+    struct stat st;
+    const ProfileHeader *h;
+    int fd;
+
+    profiles_unload();
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno == ENOENT ? 0 : -1;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*h)) {
+        close(fd);
+        fprintf(stderr, "Error: %s is not a profile store\n", path);
+        return -1;
+    }
+    g_profiles_map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (g_profiles_map == MAP_FAILED) {
+        g_profiles_map = NULL;
+        perror("mmap profiles");
+        return -1;
+    }
+    g_profiles_map_size = st.st_size;
+
+    h = g_profiles_map;
+    if (memcmp(h->magic, PROFILE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != PROFILE_VERSION || h->count > MAX_PROFILES ||
+        sizeof(*h) + (size_t)h->count * sizeof(ProfileRecord)
+            > g_profiles_map_size) {
+        fprintf(stderr, "Error: %s is not a version %d profile store\n",
+                path, PROFILE_VERSION);
+        profiles_unload();
+        return -1;
+    }
+    g_profiles = (const ProfileRecord *)(h + 1);
+    g_num_profiles = h->count;
+    return 0;
+}
+
+static const ProfileRecord *profile_find(const char *name)
+{
+    for (uint32_t i = 0; i < g_num_profiles; i++)
+        if (strncmp(g_profiles[i].name, name, PROFILE_NAME_LEN) == 0)
+            return &g_profiles[i];
+    return NULL;
+}
+
+static void profile_apply(const ProfileRecord *p, Mapping *map)
+{
+    for (int i = 0; i < NUM_MAPPINGS; i++)
+        if (p->keycode[i] > 0 && p->keycode[i] < KEY_CNT)
+            map[i].keycode = p->keycode[i];
+}
+
+/* Add or replace profile name with the mapping in map[]. The store is
+ * rewritten to a temporary file and renamed over the original, so a
+ * power cut on the USB stick leaves either the old or the new file. */
+static int profile_save(const char *path, const char *name)
+{
+    static ProfileRecord recs[MAX_PROFILES];
+    char tmp[MAX_PATH_LEN];
+    ProfileHeader h;
+    uint32_t n = 0;
+    FILE *fp;
+
+    if (strlen(name) >= PROFILE_NAME_LEN) {
+        fprintf(stderr, "Error: profile name longer than %d characters\n",
+                PROFILE_NAME_LEN - 1);
+        return -1;
+    }
+    if (profiles_load(path) < 0)
+        return -1;
+    for (uint32_t i = 0; i < g_num_profiles; i++)
+        if (strncmp(g_profiles[i].name, name, PROFILE_NAME_LEN) != 0)
+            recs[n++] = g_profiles[i];
+    profiles_unload();
+    if (n >= MAX_PROFILES) {
+        fprintf(stderr, "Error: profile store is full\n");
+        return -1;
+    }
+    memset(&recs[n], 0, sizeof(recs[n]));
+    strncpy(recs[n].name, name, PROFILE_NAME_LEN - 1);
+    for (int i = 0; i < NUM_MAPPINGS; i++)
+        recs[n].keycode[i] = (uint16_t)g_player->map[i].keycode;
+    n++;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PROFILE_MAGIC, sizeof(h.magic));
+    h.version = PROFILE_VERSION;
+    h.count   = n;
+
+    snprintf(tmp, sizeof(tmp), "%.500s.tmp", path);
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        perror("fopen profiles");
+        return -1;
+    }
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+        fwrite(recs, sizeof(recs[0]), n, fp) != n ||
+        fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        perror("write profiles");
+        fclose(fp);
+        unlink(tmp);
+        return -1;
+    }
+    fclose(fp);
+    if (rename(tmp, path) < 0) {
+        perror("rename profiles");
+        unlink(tmp);
+        return -1;
+    }
+    fprintf(stderr, "Saved profile '%s' to %s (%u profiles)\n", name, path, n);
+    return 0;
+}
+
+static void profiles_list(void)
+{
+    printf("Profiles in %s:\n", g_profiles_path);
+    if (g_num_profiles == 0)
+        printf("  (none)\n");
+    for (uint32_t i = 0; i < g_num_profiles; i++)
+        printf("  %.*s\n", PROFILE_NAME_LEN, g_profiles[i].name);
+}
+
+/* ================================================================
+ * the64 process control
+ *
+ * Replaces system("killall -9 the64") / system("the64 &"): the64 is
+ * found through /proc, killed and waited for (pidfd where available),
+ * then relaunched with posix_spawn() as our child and reaped on
+ * SIGCHLD.
+ * ================================================================ */
+
+/* the64 we spawned, if still running. Set by the translation thread,
+ * cleared by whichever thread reaps it, so accessed atomically. */
+static pid_t g_the64_pid = -1;
+
+#ifndef K2J_NO_GUIMAP   /* only a remap stops the64 */
+static int find_the64(pid_t *pids, int max)
+{
+    DIR *dir = opendir("/proc");
+    struct dirent *entry;
+    char path[64], comm[32];
+    int count = 0;
+
+    if (!dir) return 0;
+    while ((entry = readdir(dir)) != NULL && count < max) {
+        if (entry->d_name[0] < '1' || entry->d_name[0] > '9') continue;
+        snprintf(path, sizeof(path), "/proc/%.16s/comm", entry->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        ssize_t n = read(fd, comm, sizeof(comm) - 1);
+        close(fd);
+        if (n <= 0) continue;
+        comm[n] = '\0';
+        if (comm[n - 1] == '\n') comm[n - 1] = '\0';
+        if (strcmp(comm, "the64") == 0)
+            pids[count++] = (pid_t)atoi(entry->d_name);
+    }
+    closedir(dir);
+    return count;
+}
+
+/* A process is gone once /proc no longer has it or it is a zombie */
+static int pid_gone(pid_t pid)
+{
+    char path[64], buf[128];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 1;
+    buf[n] = '\0';
+    const char *p = strrchr(buf, ')');
+    return p && p[1] == ' ' && p[2] == 'Z';
+}
+
+/* Wait until deadline at most; our own child is reaped as well */
+static void wait_pid_gone(pid_t pid, uint64_t deadline)
+{
+    int pfd = -1;
+#ifdef SYS_pidfd_open
+    pfd = (int)syscall(SYS_pidfd_open, pid, 0);
+#endif
+    if (pfd >= 0) {
+        uint64_t now = time_ms();
+        struct pollfd p = { .fd = pfd, .events = POLLIN };
+        if (now < deadline)
+            poll(&p, 1, (int)(deadline - now));
+        close(pfd);
+    } else {
+        while (!pid_gone(pid) && time_ms() < deadline)
+            usleep(5000);
+    }
+
+    pid_t child = pid;
+    if (__atomic_compare_exchange_n(&g_the64_pid, &child, -1, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        waitpid(pid, NULL, WNOHANG);
+}
+
+static void the64_stop(void)
+{
+    pid_t pids[MAX_THE64_PIDS];
+    int n = find_the64(pids, MAX_THE64_PIDS);
+    uint64_t deadline = time_ms() + THE64_STOP_MS;
+
+    for (int i = 0; i < n; i++)
+        kill(pids[i], SIGKILL);
+    for (int i = 0; i < n; i++)
+        wait_pid_gone(pids[i], deadline);
+    if (n > 0)
+        fprintf(stderr, "Stopped the64 (%d process%s)\n", n, n > 1 ? "es" : "");
+}
+#endif
+
+static void the64_start(void)
+{
+    extern char **environ;
+    char *argv[] = { "the64", NULL };
+    posix_spawnattr_t attr;
+    sigset_t none, defaults;
+    pid_t pid;
+
+    /* Don't pass on our blocked signals or handlers */
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTERM);
+    sigaddset(&defaults, SIGUSR1);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGHUP);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+                                    POSIX_SPAWN_SETSIGDEF);
+
+    int err = posix_spawnp(&pid, "the64", NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start the64: %s\n", strerror(err));
+        return;
+    }
+    __atomic_store_n(&g_the64_pid, pid, __ATOMIC_RELAXED);
+    realtime_release_child(pid);
+    fprintf(stderr, "Started the64 (pid %d)\n", (int)pid);
+}
+
+/* Collect exited children so repeated remaps leave no zombies */
+static void reap_children(void)
+{
+    pid_t pid;
+    g_child_exited = 0;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+        __atomic_compare_exchange_n(&g_the64_pid, &pid, -1, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/* ================================================================
+ * Cleanup (atexit safety net)
+ * ================================================================ */
+
+static void cleanup(void)
+{
+    if (g_latency)
+        latency_dump();
+    record_close();
+
+    /* Release all held buttons, the joystick's included */
+    Player *cur = g_player;
+    for (int p = 0; p < g_num_players; p++) {
+        g_player = &g_players[p];
+        buttons_set(&g_player->btn_joy, 0);
+        g_player->joy_axis[0] = g_player->joy_axis[1] = AXIS_CENTER;
+    }
+    g_player = cur;
+    translate_release_all();
+    translate_flush();
+    for (int p = 0; p < g_num_players; p++) {
+        destroy_virtual_joystick(g_players[p].uinput_fd);
+        g_players[p].uinput_fd = -1;
+    }
+
+    ungrab_keyboards();
+
+    for (int i = 0; i < g_num_kbd_fds; i++)
+        close(g_kbd_fds[i]);
+    g_num_kbd_fds = 0;
+    if (g_joy_fd >= 0)
+        close(g_joy_fd);
+    g_joy_fd = -1;
+}
+
+/* ================================================================
+ * CLI parsing and help
+ * ================================================================ */
+
+static void print_usage(void)
+{
+    printf("keyboard2thejoystick - USB Keyboard to Virtual THEJOYSTICK\n\n");
+    printf("Creates a virtual THEJOYSTICK via Linux uinput, translating keyboard\n");
+    printf("input to joystick events for THEC64 Mini/Maxi.\n\n");
+    printf("Usage: keyboard2thejoystick [OPTIONS]\n\n");
+
+    printf("Direction keys:\n");
+    printf("  --up KEY         (current: %-14s)  --upleft KEY    (current: %s)\n",
+           keycode_to_name(g_player->map[0].keycode), keycode_to_name(g_player->map[4].keycode));
+    printf("  --down KEY       (current: %-14s)  --upright KEY   (current: %s)\n",
+           keycode_to_name(g_player->map[1].keycode), keycode_to_name(g_player->map[5].keycode));
+    printf("  --left KEY       (current: %-14s)  --downleft KEY  (current: %s)\n",
+           keycode_to_name(g_player->map[2].keycode), keycode_to_name(g_player->map[6].keycode));
+    printf("  --right KEY      (current: %-14s)  --downright KEY (current: %s)\n",
+           keycode_to_name(g_player->map[3].keycode), keycode_to_name(g_player->map[7].keycode));
+    printf("\n");
+
+    printf("Button keys:\n");
+    printf("  --leftfire KEY   (current: %-14s)  --rightfire KEY (current: %s)\n",
+           keycode_to_name(g_player->map[8].keycode), keycode_to_name(g_player->map[9].keycode));
+    printf("  --lefttri KEY    (current: %-14s)  --righttri KEY  (current: %s)\n",
+           keycode_to_name(g_player->map[10].keycode), keycode_to_name(g_player->map[11].keycode));
+    printf("  --menu1 KEY      (current: %-14s)  --menu2 KEY     (current: %s)\n",
+           keycode_to_name(g_player->map[12].keycode), keycode_to_name(g_player->map[13].keycode));
+    printf("  --menu3 KEY      (current: %-14s)  --menu4 KEY     (current: %s)\n",
+           keycode_to_name(g_player->map[14].keycode), keycode_to_name(g_player->map[15].keycode));
+    printf("\n");
+
+    printf("Other:\n");
+    printf("  --help           Show this help with current configuration\n");
+#ifndef K2J_NO_GUIMAP
+    printf("  --guimap         Interactive framebuffer mapping mode\n");
+#endif
+    printf("  --config FILE    Load key options from FILE (e.g. a saved\n");
+    printf("                   keyboard2thejoystick.sh); SIGHUP reloads it live\n");
+    printf("  --profile NAME   Apply a saved profile (later options override it)\n");
+    printf("  --profiles FILE  Profile store (default: %s)\n", PROFILES_DEFAULT);
+    printf("  --save-profile NAME  Save the mapping given by the other options\n");
+    printf("                   as NAME in the profile store and exit\n");
+    printf("  --list-profiles  List the profiles in the store and exit\n");
+    printf("  --macro KEY:STEPS  Play a timed sequence on KEY for the current\n");
+    printf("                   --player, e.g. f1:menu1+menu2/100,_/50,leftfire/80\n");
+    printf("                   (STEP/ms); not stored in profiles or --config\n");
+    printf("  --socd MODE      Opposite directions: neutral (cancel, default),\n");
+    printf("                   last (newest press wins), first (oldest wins)\n");
+    printf("  --ramp MS        Ease the stick out to full deflection over MS while\n");
+    printf("                   a direction is held (--ramp-rate HZ updates/s,\n");
+    printf("                   default %d)\n", RAMP_DEFAULT_HZ);
+    printf("  --turbo BUTTON[:HZ]  Autofire while BUTTON is held, e.g. leftfire:12\n");
+    printf("                   (default %d Hz, repeatable)\n", TURBO_DEFAULT_HZ);
+    printf("  --game-dir DIR   Switch to the profile named after each game the64\n");
+    printf("                   opens under DIR (repeatable)\n");
+    printf("  --players N      Create N virtual joysticks (1-%d); keyboards are\n", MAX_PLAYERS);
+    printf("                   shared out between them in /dev/input order\n");
+    printf("  --player N       Key options after this configure player N\n");
+    printf("  --split          Every keyboard feeds every player (one keyboard,\n");
+    printf("                   two sets of keys)\n");
+    printf("  --merge-joystick Grab a real joystick and combine it with the keys\n");
+    printf("                   of the current --player (default player 1)\n");
+    printf("  --daemon         Go to the background once the joystick device exists\n");
+    printf("  --realtime [PRIO] Run SCHED_FIFO (default priority %d) with memory\n",
+           RT_DEFAULT_PRIO);
+    printf("                   locked, falling back to a higher nice level\n");
+    printf("  --cpu N          Pin the translator to CPU N\n");
+    printf("  --stats          Print the counters of the running instance\n");
+    printf("  --latency        Measure key-to-uinput latency; kill -USR1 prints\n");
+    printf("                   min/p50/p99/max, also printed at exit\n");
+    printf("  --record FILE    Save every keyboard event read to a trace file\n");
+    printf("  --bench FILE     Replay a trace through the translator offline and\n");
+    printf("                   report events/sec (--bench-loops N, default 100)\n");
+    printf("\n");
+
+    printf("Key names: single chars (a, 7), or names (space, lalt, lctrl,\n");
+    printf("  lshift, rshift, tab, enter, esc, bracketleft, bracketright,\n");
+    printf("  f1-f12, up, down, left, right, etc.)\n");
+    printf("\n");
+
+    printf("Direction layout (QWEASDZXC):\n");
+    printf("  Q=Up-Left    W=Up      E=Up-Right\n");
+    printf("  A=Left       (S=n/a)   D=Right\n");
+    printf("  Z=Down-Left  X=Down    C=Down-Right\n");
+}
+
+/* --turbo BUTTON[:HZ], e.g. "leftfire" or "rightfire:15" */
+static int apply_turbo_option(Mapping *map, const char *val)
+{
+    char name[32];
+    int hz = TURBO_DEFAULT_HZ;
+
+    if (!val) {
+        fprintf(stderr, "Error: --turbo requires a button name\n");
+        return -1;
+    }
+    const char *colon = strchr(val, ':');
+    size_t len = colon ? (size_t)(colon - val) : strlen(val);
+    if (colon) hz = atoi(colon + 1);
+    if (len >= sizeof(name) - 2 || hz < 1 || hz > TURBO_MAX_HZ) {
+        fprintf(stderr, "Error: bad --turbo '%s' (rate 1-%d Hz)\n",
+                val, TURBO_MAX_HZ);
+        return -1;
+    }
+    snprintf(name, sizeof(name), "--%.*s", (int)len, val);
+    for (int b = NUM_DIRECTIONS; b < NUM_MAPPINGS; b++) {
+        if (strcmp(name, map[b].cli_name) == 0) {
+            map[b].turbo_hz = hz;
+            return 1;
+        }
+    }
+    fprintf(stderr, "Error: --turbo: unknown button '%.*s'\n", (int)len, val);
+    return -1;
+}
+
+/* Handle "--up KEY" style options against map[]. Returns 1 if opt was
+ * a mapping option (val consumed), 0 if not, -1 on a bad key name. */
+static int apply_mapping_option(Mapping *map, const char *opt, const char *val)
+{
+    if (strcmp(opt, "--turbo") == 0)
+        return apply_turbo_option(map, val);
+    for (int m = 0; m < NUM_MAPPINGS; m++) {
+        if (strcmp(opt, map[m].cli_name) != 0) continue;
+        if (!val) {
+            fprintf(stderr, "Error: %s requires a key name\n", opt);
+            return -1;
+        }
+        int kc = parse_keyname(val);
+        if (kc < 0) {
+            fprintf(stderr, "Error: unknown key name '%s'\n", val);
+            fprintf(stderr, "Run with --help for a list of key names\n");
+            return -1;
+        }
+        map[m].keycode = kc;
+        return 1;
+    }
+    return 0;
+}
+
+/* Read mapping options from a file. The format is whatever
+ * guimap_save_script() writes: "#" comments, and "--up w"-style pairs
+ * anywhere, so a saved keyboard2thejoystick.sh doubles as a config
+ * file. Other tokens (exec, the program path, line continuations,
+ * non-mapping options) are ignored. In a multi-player script only the
+ * "--player N" section for player (0-based) is read, plus anything
+ * before the first "--player". */
+static int load_config(const char *path, Mapping *map, int player)
+{
+    int section = player;
+    char buf[8192];
+    char *tok[512];
+    int ntok = 0;
+    FILE *fp = fopen(path, "r");
+
+    if (!fp) {
+        fprintf(stderr, "Error: cannot open config '%s': %s\n",
+                path, strerror(errno));
+        return -1;
+    }
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+
+    for (char *p = buf; *p && ntok < (int)(sizeof(tok) / sizeof(tok[0])); ) {
+        if (*p == '#') {
+            while (*p && *p != '\n') p++;
+            continue;
+        }
+        if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\\') {
+            *p++ = '\0';
+            continue;
+        }
+        tok[ntok++] = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+            p++;
+    }
+
+    for (int i = 0; i < ntok; i++) {
+        if (strncmp(tok[i], "--", 2) != 0) continue;
+        if (strcmp(tok[i], "--player") == 0 && i + 1 < ntok) {
+            section = atoi(tok[++i]) - 1;
+            continue;
+        }
+        if (section != player) continue;
+        int r = apply_mapping_option(map, tok[i], i + 1 < ntok ? tok[i + 1] : NULL);
+        if (r < 0) {
+            fprintf(stderr, "Error: in config '%s'\n", path);
+            return -1;
+        }
+        i += r;
+    }
+    return 0;
+}
+
+static int parse_args(int argc, char **argv, int *help, int *guimap,
+                      int *list_profiles)
+{
+    *help = 0;
+    *guimap = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            *help = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--guimap") == 0) {
             *guimap = 1;
             continue;
         }
+        if (strcmp(argv[i], "--latency") == 0) {
+            g_latency = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--daemon") == 0) {
+            g_daemon = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--stats") == 0) {
+            g_show_stats = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--realtime") == 0) {
+            g_rt_prio = RT_DEFAULT_PRIO;
+            if (i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9') {
+                g_rt_prio = atoi(argv[++i]);
+                if (g_rt_prio < 1 || g_rt_prio > 99) {
+                    fprintf(stderr, "Error: --realtime priority must be 1-99\n");
+                    return -1;
+                }
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--cpu") == 0) {
+            g_rt_cpu = i + 1 < argc ? atoi(argv[i + 1]) : -1;
+            if (i + 1 >= argc || g_rt_cpu < 0 || g_rt_cpu >= CPU_SETSIZE) {
+                fprintf(stderr, "Error: --cpu needs a CPU number\n");
+                return -1;
+            }
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--split") == 0) {
+            g_split = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--merge-joystick") == 0) {
+            g_merge_player = (int)(g_player - g_players);
+            continue;
+        }
+        if (strcmp(argv[i], "--players") == 0 ||
+            strcmp(argv[i], "--player") == 0) {
+            int n = i + 1 < argc ? atoi(argv[i + 1]) : 0;
+            if (n < 1 || n > MAX_PLAYERS) {
+                fprintf(stderr, "Error: %s needs a number from 1 to %d\n",
+                        argv[i], MAX_PLAYERS);
+                return -1;
+            }
+            /* --player N: the options that follow configure player N */
+            if (strcmp(argv[i], "--player") == 0)
+                g_player = &g_players[n - 1];
+            if (n > g_num_players)
+                g_num_players = n;
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--record") == 0 ||
+            strcmp(argv[i], "--bench") == 0 ||
+            strcmp(argv[i], "--bench-loops") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", argv[i]);
+                return -1;
+            }
+            if (strcmp(argv[i], "--record") == 0)
+                g_record_path = argv[i + 1];
+            else if (strcmp(argv[i], "--bench") == 0)
+                g_bench_path = argv[i + 1];
+            else if ((g_bench_loops = atol(argv[i + 1])) <= 0) {
+                fprintf(stderr, "Error: --bench-loops needs a positive count\n");
+                return -1;
+            }
+            i++;
+            continue;
+        }
+
+        if (strcmp(argv[i], "--profiles") == 0 ||
+            strcmp(argv[i], "--profile") == 0 ||
+            strcmp(argv[i], "--save-profile") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", argv[i]);
+                return -1;
+            }
+            if (strcmp(argv[i], "--profiles") == 0) {
+                g_profiles_path = argv[++i];
+                profiles_unload();
+                continue;
+            }
+            if (strcmp(argv[i], "--save-profile") == 0) {
+                g_save_profile = argv[++i];
+                continue;
+            }
+            if (!g_profiles_map && profiles_load(g_profiles_path) < 0)
+                return -1;
+            const ProfileRecord *p = profile_find(argv[++i]);
+            if (!p) {
+                fprintf(stderr, "Error: no profile '%s' in %s\n",
+                        argv[i], g_profiles_path);
+                return -1;
+            }
+            profile_apply(p, g_player->map);
+            continue;
+        }
+        if (strcmp(argv[i], "--macro") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --macro requires KEY:STEPS\n");
+                return -1;
+            }
+            if (macro_add(argv[++i]) < 0)
+                return -1;
+            continue;
+        }
+        if (strcmp(argv[i], "--ramp") == 0 ||
+            strcmp(argv[i], "--ramp-rate") == 0) {
+            int ramp = strcmp(argv[i], "--ramp") == 0;
+            int v = i + 1 < argc ? atoi(argv[i + 1]) : 0;
+            if (ramp ? (v < 1 || v > 10000) : (v < 10 || v > 1000)) {
+                fprintf(stderr, "Error: %s needs %s\n", argv[i],
+                        ramp ? "1-10000 ms" : "10-1000 Hz");
+                return -1;
+            }
+            if (ramp) g_ramp_ms = v;
+            else      g_ramp_hz = v;
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--socd") == 0) {
+            const char *mode = i + 1 < argc ? argv[++i] : "";
+            if (strcmp(mode, "neutral") == 0)    g_socd = SOCD_NEUTRAL;
+            else if (strcmp(mode, "last") == 0)  g_socd = SOCD_LAST;
+            else if (strcmp(mode, "first") == 0) g_socd = SOCD_FIRST;
+            else {
+                fprintf(stderr, "Error: --socd needs neutral, last or first\n");
+                return -1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--game-dir") == 0) {
+            if (i + 1 >= argc || g_num_game_dirs >= MAX_GAME_DIRS) {
+                fprintf(stderr, "Error: --game-dir requires a directory "
+                        "(at most %d)\n", MAX_GAME_DIRS);
+                return -1;
+            }
+            g_game_dirs[g_num_game_dirs++] = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--list-profiles") == 0) {
+            *list_profiles = 1;
+            continue;
+        }
+
+        if (strcmp(argv[i], "--config") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --config requires a file name\n");
+                return -1;
+            }
+            g_config_path = argv[++i];
+            g_config_player = (int)(g_player - g_players);
+            memcpy(g_config_base, g_player->map, sizeof(g_config_base));
+            g_config_args  = argv + i + 1;
+            g_config_nargs = argc - i - 1;
+            if (load_config(g_config_path, g_player->map, g_config_player) < 0)
+                return -1;
+            continue;
+        }
+
+        int r = apply_mapping_option(g_player->map, argv[i],
+                                     i + 1 < argc ? argv[i + 1] : NULL);
+        if (r < 0)
+            return -1;
+        if (r > 0) {
+            i++;
+            continue;
+        }
+        fprintf(stderr, "Error: unknown option '%s'\n", argv[i]);
+        fprintf(stderr, "Run with --help for usage information\n");
+        return -1;
+    }
+
+    Player *cur = g_player;
+    for (int p = 0; p < g_num_players; p++) {
+        g_player = &g_players[p];
+        build_keymap();
+    }
+    g_player = cur;
+    return 0;
+}
+
+/* ================================================================
+ * Translation thread <-> remap GUI
+ *
+ * In normal mode the event loop runs on its own thread and never waits
+ * for the GUI; the main thread only runs the Ctrl+R remap screen. Two
+ * single-producer single-consumer rings connect them, each paired
+ * with an eventfd for wakeups:
+ *
+ *   g_to_gui  translator -> GUI: start a remap, key presses, quit
+ *   g_to_tr   GUI -> translator: the finished remap
+ *
+ * While a remap runs, the keyboards feeding that player stay grabbed
+ * and their key presses go to the GUI instead of being translated;
+ * every other keyboard keeps playing.
+ * ================================================================ */
+
+/* Ring indices; the slots live next to each ring. head is only
+ * written by the consumer, tail only by the producer. */
+typedef struct {
+    unsigned head, tail;
+} Spsc;
+
+/* Slot to fill for the next push (size is a power of two), -1 if full */
+static int spsc_push_slot(Spsc *q, unsigned size)
+{
+    unsigned t = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    if (t - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == size)
+        return -1;
+    return (int)(t & (size - 1));
+}
+
+static void spsc_push_done(Spsc *q)
+{
+    unsigned t = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    __atomic_store_n(&q->tail, t + 1, __ATOMIC_RELEASE);
+}
+
+/* Slot holding the oldest entry, -1 if empty */
+static int spsc_pop_slot(Spsc *q, unsigned size)
+{
+    unsigned h = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    if (h == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+        return -1;
+    return (int)(h & (size - 1));
+}
+
+static void spsc_pop_done(Spsc *q)
+{
+    unsigned h = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    __atomic_store_n(&q->head, h + 1, __ATOMIC_RELEASE);
+}
+
+#define GUI_MSG_REMAP 1   /* arg = player, mappings in g_remap_maps */
+#define GUI_MSG_KEY   2   /* arg = key code pressed */
+#define GUI_MSG_QUIT  3
+
+#define GUI_SLOTS     64
+#define TR_SLOTS      2   /* at most one remap is outstanding */
+
+typedef struct {
+    int kind, arg;
+} GuiMsg;
+
+typedef struct {
+    int     player;
+    int     applied;
+    Mapping map[NUM_MAPPINGS];
+} TrMsg;
+
+static Spsc   g_to_gui;
+static GuiMsg g_to_gui_msg[GUI_SLOTS];
+static int    g_gui_efd = -1;
+static Spsc   g_to_tr;
+static TrMsg  g_to_tr_msg[TR_SLOTS];
+static int    g_tr_efd = -1;
+
+#ifndef K2J_NO_GUIMAP
+/* Every player's mapping as a remap started; the GUI edits its copy
+ * (and exports the others) until it answers */
+static Mapping g_remap_maps[MAX_PLAYERS][NUM_MAPPINGS];
+#endif
+
+static int threads_init(void)
+{
+    g_gui_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    g_tr_efd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_gui_efd < 0 || g_tr_efd < 0) {
+        perror("eventfd");
+        return -1;
+    }
+    return 0;
+}
+
+static void efd_wake(int fd)
+{
+    uint64_t one = 1;
+    ssize_t r = write(fd, &one, sizeof(one));
+    (void)r;   /* only fails if a wakeup is already pending */
+}
+
+static void efd_ack(int fd)
+{
+    uint64_t n;
+    ssize_t r = read(fd, &n, sizeof(n));
+    (void)r;
+}
+
+/* Translator side. A full ring drops the message: the GUI is then
+ * far behind the keyboard anyway. */
+static void gui_post(int kind, int arg)
+{
+    int i = spsc_push_slot(&g_to_gui, GUI_SLOTS);
+    if (i < 0) return;
+    g_to_gui_msg[i].kind = kind;
+    g_to_gui_msg[i].arg  = arg;
+    spsc_push_done(&g_to_gui);
+    efd_wake(g_gui_efd);
+}
+
+/* GUI side: next message, 0 if none */
+static int gui_recv(GuiMsg *m)
+{
+    int i = spsc_pop_slot(&g_to_gui, GUI_SLOTS);
+    if (i < 0) return 0;
+    *m = g_to_gui_msg[i];
+    spsc_pop_done(&g_to_gui);
+    return 1;
+}
+
+/* ================================================================
+ * Normal mode: main event loop
+ * ================================================================ */
+
+/* A keyboard went away (unplugged, USB reset): forget its fd so the
+ * event loop does not spin on EPOLLHUP. */
+static void drop_keyboard(int k)
+{
+    fprintf(stderr, "Keyboard fd %d removed\n", g_kbd_fds[k]);
+    loop_del(&g_loop, g_kbd_fds[k]);
+    close(g_kbd_fds[k]);
+
+    /* Its key releases will never arrive */
+    Player *cur = g_player;
+    for (unsigned m = g_kbd_players[k]; m; m &= m - 1) {
+        g_player = &g_players[__builtin_ctz(m)];
+        emit_release_all();
+    }
+    g_player = cur;
+    translate_flush();
+
+    g_num_kbd_fds--;
+    if (k != g_num_kbd_fds) {
+        g_kbd_fds[k]     = g_kbd_fds[g_num_kbd_fds];
+        g_kbd_grabbed[k] = g_kbd_grabbed[g_num_kbd_fds];
+        g_kbd_rep_off[k] = g_kbd_rep_off[g_num_kbd_fds];
+        memcpy(g_kbd_rep[k], g_kbd_rep[g_num_kbd_fds], sizeof(g_kbd_rep[k]));
+        g_kbd_players[k] = g_kbd_players[g_num_kbd_fds];
+        g_kbd_rd[k]      = g_kbd_rd[g_num_kbd_fds];
+        memcpy(g_kbd_nodes[k], g_kbd_nodes[g_num_kbd_fds], KBD_NODE_LEN);
+        loop_set_tag(&g_loop, g_kbd_fds[k], LOOP_TAG(SRC_KBD, k));
+        __atomic_store_n(&g_stats->kbd_events[k],
+                         g_stats->kbd_events[g_num_kbd_fds], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&g_stats->kbd_events[g_num_kbd_fds], 0, __ATOMIC_RELAXED);
+    STAT_ADD(keyboards_dropped, 1);
+    stats_keyboards(g_kbd_nodes, g_num_kbd_fds);
+}
+
+/* Pick the players keyboard slot k feeds: all of them with --split,
+ * otherwise the player with the fewest keyboards, so keyboards found
+ * at startup go to players 1, 2, ... in /dev/input order. */
+static void assign_player(int k)
+{
+    int count[MAX_PLAYERS] = { 0 };
+    int best = 0;
+
+    if (g_split) {
+        g_kbd_players[k] = ALL_PLAYERS;
+        return;
+    }
+    for (int i = 0; i < g_num_kbd_fds; i++)
+        if (i != k && g_kbd_players[i])
+            count[__builtin_ctz(g_kbd_players[i])]++;
+    for (int p = 1; p < g_num_players; p++)
+        if (count[p] < count[best]) best = p;
+    g_kbd_players[k] = (uint8_t)(1u << best);
+    if (g_num_players > 1)
+        fprintf(stderr, "Keyboard %s -> player %d\n", g_kbd_nodes[k], best + 1);
+}
+
+/* ================================================================
+ * Joystick merge (--merge-joystick)
+ * ================================================================ */
+
+/* A real joystick is grabbed and folded into one player's virtual
+ * joystick, so the64 sees a single controller driven by both: a
+ * button is down while either side holds it, and an axis the keys
+ * leave centred follows the stick. */
+
+static EvReader g_joy_rd;
+static int g_joy_min[2], g_joy_max[2];   /* its ABS_X/ABS_Y range */
+
+/* Apply one joystick button or axis to g_player */
+static void merge_button_joy(int code, int value)
+{
+    button_set(&g_player->btn_joy, code, value);
+}
+
+static void merge_axis_joy(int a, int value)
+{
+    int range = g_joy_max[a] - g_joy_min[a];
+    int v = range > 0 ? (int)((int64_t)(value - g_joy_min[a]) *
+                              (AXIS_MAX - AXIS_MIN) / range) + AXIS_MIN
+                      : AXIS_CENTER;
+
+    if (v < AXIS_MIN) v = AXIS_MIN;
+    if (v > AXIS_MAX) v = AXIS_MAX;
+    if (abs(v - AXIS_CENTER) <= AXIS_FLAT)   /* stick jitter at rest */
+        v = AXIS_CENTER;
+    if (v != g_player->joy_axis[a]) {
+        g_player->joy_axis[a] = (uint8_t)v;
+        g_player->axis_dirty = 1;
+    }
+}
+
+/* Bring the player in line with what the joystick holds right now
+ * (attach, resume), or with nothing held when fd is -1 (pause, remap,
+ * unplug). Events missed while it was not ours are never replayed. */
+static void merge_sync(int fd)
+{
+    unsigned long keybits[NBITS(KEY_MAX)];
+    struct input_absinfo ai;
+    Player *cur = g_player;
+
+    g_player = &g_players[g_merge_player];
+    memset(keybits, 0, sizeof(keybits));
+    if (fd >= 0)
+        ioctl(fd, EVIOCGKEY(sizeof(keybits)), keybits);
+    for (int code = BTN_TRIGGER; code <= BTN_BASE6; code++)
+        merge_button_joy(code, TEST_BIT(code, keybits) ? 1 : 0);
+    for (int a = 0; a < 2; a++) {
+        if (fd >= 0 && ioctl(fd, EVIOCGABS(a ? ABS_Y : ABS_X), &ai) == 0)
+            merge_axis_joy(a, ai.value);
+        else
+            merge_axis_joy(a, (g_joy_min[a] + g_joy_max[a] + 1) / 2);
+    }
+    g_player = cur;
+    translate_flush();
+}
+
+/* Take over the joystick so the64 does not also read it directly */
+static void merge_grab(int on)
+{
+    if (g_joy_fd < 0) return;
+    if (ioctl(g_joy_fd, EVIOCGRAB, on ? 1 : 0) < 0 && on) {
+        perror("Warning: EVIOCGRAB joystick");
+        STAT_ADD(grab_failures, 1);
+    }
+    merge_sync(on ? g_joy_fd : -1);
+}
+
+static void merge_attach(int fd, const char *node)
+{
+    struct input_absinfo ai;
+
+    for (int a = 0; a < 2; a++) {
+        g_joy_min[a] = AXIS_MIN;
+        g_joy_max[a] = AXIS_MAX;
+        if (ioctl(fd, EVIOCGABS(a ? ABS_Y : ABS_X), &ai) == 0 &&
+            ai.maximum > ai.minimum) {
+            g_joy_min[a] = ai.minimum;
+            g_joy_max[a] = ai.maximum;
+        }
+    }
+    g_joy_fd = fd;
+    snprintf(g_joy_node, sizeof(g_joy_node), "%s", node);
+    memset(&g_joy_rd, 0, sizeof(g_joy_rd));
+    if (g_latency)
+        g_joy_rd.clock = latency_set_clock(fd);
+    if (!g_suspended && !__atomic_load_n(&g_remap_active, __ATOMIC_RELAXED))
+        merge_grab(1);
+    loop_add(&g_loop, fd, LOOP_TAG(SRC_JOY, 0));
+    if (g_num_players > 1)
+        fprintf(stderr, "Joystick %s -> player %d\n", node, g_merge_player + 1);
+}
+
+static void merge_detach(void)
+{
+    fprintf(stderr, "Joystick %s removed\n", g_joy_node);
+    merge_sync(-1);
+    loop_del(&g_loop, g_joy_fd);
+    close(g_joy_fd);
+    g_joy_fd = -1;
+    g_joy_node[0] = '\0';
+}
+
+/* Hotplug: adopt node if it is a joystick and none is merged yet */
+static int merge_try(const char *node)
+{
+    if (g_merge_player < 0 || g_joy_fd >= 0) return 0;
+    int fd = open_joystick(node);
+    if (fd < 0) return 0;
+    merge_attach(fd, node);
+    return 1;
+}
+
+/* Joystick input: translated in place, one uinput frame per report */
+static void merge_handle(void)
+{
+    const struct input_event *ev;
+    Player *cur = g_player;
+    int n, nev = 0;
+    int ignore = g_suspended ||
+                 __atomic_load_n(&g_remap_active, __ATOMIC_RELAXED);
+
+    g_player = &g_players[g_merge_player];
+    g_lat_clock = g_joy_rd.clock;
+    while ((n = ev_next(&g_joy_rd, g_joy_fd, &ev)) > 0) {
+        nev++;
+        if (ignore) continue;
+        if (ev->type == EV_KEY && ev->code >= BTN_TRIGGER &&
+            ev->code <= BTN_BASE6 && ev->value != 2) {
+            if (g_latency)
+                latency_mark(ev);
+            merge_button_joy(ev->code, ev->value);
+        } else if (ev->type == EV_ABS &&
+                   (ev->code == ABS_X || ev->code == ABS_Y)) {
+            if (g_latency)
+                latency_mark(ev);
+            merge_axis_joy(ev->code == ABS_Y, ev->value);
+        } else if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+            translate_flush();
+        }
+    }
+    g_player = cur;
+    translate_flush();
+    STAT_ADD(joy_events, nev);
+    if (n < 0)
+        merge_detach();
+}
+
+/* ================================================================
+ * Keyboard hotplug (inotify on /dev/input)
+ * ================================================================ */
+
+static int g_hotplug_fd = -1;
+
+static int hotplug_init(void)
+{
+    g_hotplug_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_hotplug_fd < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+    /* IN_ATTRIB catches nodes whose permissions are fixed up after
+     * creation and so could not be opened on IN_CREATE */
+    if (inotify_add_watch(g_hotplug_fd, "/dev/input",
+                          IN_CREATE | IN_ATTRIB | IN_DELETE) < 0) {
+        perror("inotify_add_watch /dev/input");
+        close(g_hotplug_fd);
+        g_hotplug_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int find_keyboard_node(const char *node)
+{
+    for (int k = 0; k < g_num_kbd_fds; k++)
+        if (strcmp(g_kbd_nodes[k], node) == 0)
+            return k;
+    return -1;
+}
+
+static void hotplug_add(const char *node)
+{
+    if (find_keyboard_node(node) >= 0 || g_num_kbd_fds >= MAX_KEYBOARDS)
+        return;
+
+    int fd = open_keyboard(node);
+    if (fd < 0) return;
+
+    int k = g_num_kbd_fds++;
+    g_kbd_fds[k] = fd;
+    g_kbd_grabbed[k] = 0;
+    g_kbd_rep_off[k] = 0;
+    snprintf(g_kbd_nodes[k], KBD_NODE_LEN, "%s", node);
+    g_kbd_players[k] = 0;
+    assign_player(k);
+
+    if (!g_suspended)
+        grab_keyboard(k);
+    else
+        kbd_set_mask(fd);
+    drain_keyboard_events(&g_kbd_rd[k], &fd, 1);
+    if (g_latency)
+        g_kbd_rd[k].clock = latency_set_clock(fd);
+    loop_add(&g_loop, fd, LOOP_TAG(SRC_KBD, k));
+    STAT_ADD(keyboards_added, 1);
+    stats_keyboards(g_kbd_nodes, g_num_kbd_fds);
+}
+
+static void hotplug_handle(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(g_hotplug_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *ie = (const struct inotify_event *)p;
+            p += sizeof(*ie) + ie->len;
+
+            if (ie->len == 0 || !is_event_node(ie->name)) continue;
+
+            if (ie->mask & IN_DELETE) {
+                int k = find_keyboard_node(ie->name);
+                if (k >= 0) drop_keyboard(k);
+                else if (g_joy_fd >= 0 && strcmp(ie->name, g_joy_node) == 0)
+                    merge_detach();
+            } else if (!merge_try(ie->name)) {
+                hotplug_add(ie->name);
+            }
+        }
+    }
+}
+
+static void loop_add_keyboards(void)
+{
+    for (int k = 0; k < g_num_kbd_fds; k++)
+        loop_add(&g_loop, g_kbd_fds[k], LOOP_TAG(SRC_KBD, k));
+}
+
+static void print_mappings(const char *title)
+{
+    fprintf(stderr, "\n%s:\n", title);
+    for (int p = 0; p < g_num_players; p++) {
+        const Player *pl = &g_players[p];
+
+        if (g_num_players > 1)
+            fprintf(stderr, " Player %d:\n", p + 1);
+        for (int i = 0; i < NUM_MAPPINGS; i++) {
+            if (pl->map[i].turbo_hz)
+                fprintf(stderr, "  %-12s = %s (turbo %d Hz)\n", pl->map[i].label,
+                        keycode_to_name(pl->map[i].keycode), pl->map[i].turbo_hz);
+            else
+                fprintf(stderr, "  %-12s = %s\n",
+                        pl->map[i].label, keycode_to_name(pl->map[i].keycode));
+        }
+        for (int i = 0; i < g_num_macros; i++)
+            if (pl->macro_key[g_macros[i].keycode] == i + 1)
+                fprintf(stderr, "  %-12s = %s (%d events)\n", "Macro",
+                        g_macros[i].spec, g_macros[i].count);
+    }
+}
+
+/* Each player's base_map holds its mapping from the command line,
+ * --config and Ctrl+R; per-game profiles are applied to player 1 on
+ * top of it and reverted to it. */
+static char g_game[PROFILE_NAME_LEN];   /* game whose profile is active */
+
+/* Swap a new mapping in for the current player while the64 and the
+ * virtual joysticks keep running. Outputs held under the old bindings
+ * are released first so nothing sticks. */
+static void swap_mapping(const Mapping *next)
+{
+    emit_release_all();
+    translate_flush();
+    memcpy(g_player->map, next, sizeof(g_player->map));
+    build_keymap();
+    kbd_mask_all();
+}
+
+/* The current player's base mapping plus the profile for g_game, if
+ * it has one */
+static void current_mapping(Mapping *out)
+{
+    const ProfileRecord *p = NULL;
+
+    if (g_player == &g_players[0] && g_game[0])
+        p = profile_find(g_game);
+    memcpy(out, g_player->base_map, sizeof(g_player->base_map));
+    if (p) profile_apply(p, out);
+}
+
+/* Re-apply the key, --turbo and --profile options that followed
+ * --config on the command line, so they still override the file */
+static void config_reapply_args(Mapping *map)
+{
+    int section = g_config_player;
+
+    for (int i = 0; i < g_config_nargs; i++) {
+        const char *opt = g_config_args[i];
+        const char *val = i + 1 < g_config_nargs ? g_config_args[i + 1] : NULL;
+
+        if (strcmp(opt, "--player") == 0 && val) {
+            section = atoi(val) - 1;
+            i++;
+            continue;
+        }
+        if (section != g_config_player) continue;
+        if (strcmp(opt, "--profile") == 0 && val) {
+            const ProfileRecord *p = profile_find(val);
+            if (p) profile_apply(p, map);
+            i++;
+            continue;
+        }
+        int r = apply_mapping_option(map, opt, val);
+        if (r > 0) i += r;
+    }
+}
+
+/* SIGHUP: re-read --config (and the profile store, which may have
+ * been replaced by --save-profile). The player it was given for is
+ * rebuilt as at startup: its mapping from before --config, then the
+ * file, then the options after it, so removing a binding from the
+ * file removes it here too. A bad file keeps the previous mapping. */
+static void reload_config(void)
+{
+    Mapping next[NUM_MAPPINGS];
+    Player *cfg = &g_players[g_config_player];
+
+    g_reload = 0;
+    if (!g_config_path && g_num_game_dirs == 0) {
+        fprintf(stderr, "SIGHUP ignored: no --config file to reload\n");
+        return;
+    }
+    if (g_num_game_dirs > 0 || g_profiles_map)
+        profiles_load(g_profiles_path);
+    if (g_config_path) {
+        memcpy(next, g_config_base, sizeof(next));
+        if (load_config(g_config_path, next, g_config_player) < 0) {
+            fprintf(stderr, "Keeping previous mappings\n");
+            return;
+        }
+        config_reapply_args(next);
+        memcpy(cfg->base_map, next, sizeof(next));
+    }
+
+    Player *cur = g_player;
+    for (int p = 0; p < g_num_players; p++) {
+        g_player = &g_players[p];
+        current_mapping(next);
+        swap_mapping(next);
+    }
+    g_player = cur;
+    STAT_ADD(reloads, 1);
+    print_mappings("Reloaded key mappings");
+}
+
+/* ================================================================
+ * Per-game profiles (--game-dir)
+ *
+ * the64 opens the game image when a title is launched, so an
+ * IN_OPEN watch on the game directories tells us what is running
+ * without polling. The opened file's name minus extension selects
+ * the profile of the same name (case-insensitive); launching a game
+ * with no profile reverts to the base mapping.
+ * ================================================================ */
+
+#define MAX_GAME_WATCHES  64
+#define GAME_DIR_DEPTH    3
+
+static int g_game_fd = -1;
+static int g_num_game_wd;
+
+/* File types the64 loads as games; opening anything else with no
+ * matching profile (carousel art, its own config) changes nothing */
+static int is_game_file(const char *ext)
+{
+    static const char *const exts[] = {
+        "d64", "d71", "d81", "g64", "t64", "tap", "prg", "p00",
+        "crt", "tcrt", "zip", NULL
+    };
+    for (int i = 0; exts[i]; i++)
+        if (strcasecmp(ext, exts[i]) == 0)
+            return 1;
+    return 0;
+}
+
+static void game_watch_dir(const char *path, int depth)
+{
+    DIR *dir;
+    struct dirent *de;
+    char sub[MAX_PATH_LEN];
+
+    if (g_num_game_wd >= MAX_GAME_WATCHES) return;
+    if (inotify_add_watch(g_game_fd, path, IN_OPEN | IN_ONLYDIR) < 0) {
+        fprintf(stderr, "Warning: cannot watch %s: %s\n", path, strerror(errno));
+        return;
+    }
+    g_num_game_wd++;
+
+    if (depth <= 1 || !(dir = opendir(path))) return;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN) continue;
+        snprintf(sub, sizeof(sub), "%.250s/%.250s", path, de->d_name);
+        game_watch_dir(sub, depth - 1);
+    }
+    closedir(dir);
+}
+
+static int game_watch_init(void)
+{
+    if (g_num_game_dirs == 0) return 0;
+    if (!g_profiles_map && profiles_load(g_profiles_path) < 0)
+        return -1;
+
+    g_game_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_game_fd < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+    for (int i = 0; i < g_num_game_dirs; i++)
+        game_watch_dir(g_game_dirs[i], GAME_DIR_DEPTH);
+    fprintf(stderr, "Watching %d game directories, %u profiles\n",
+            g_num_game_wd, g_num_profiles);
+    return 0;
+}
+
+static void game_watch_close(void)
+{
+    if (g_game_fd >= 0) close(g_game_fd);
+    g_game_fd = -1;
+    g_num_game_wd = 0;
+}
+
+static void game_opened(const char *name)
+{
+    char stem[PROFILE_NAME_LEN];
+    const char *dot = strrchr(name, '.');
+    size_t len = dot ? (size_t)(dot - name) : strlen(name);
+    Mapping next[NUM_MAPPINGS];
+
+    if (len == 0 || len >= sizeof(stem)) return;
+    memcpy(stem, name, len);
+    stem[len] = '\0';
+
+    const ProfileRecord *p = NULL;
+    for (uint32_t i = 0; i < g_num_profiles && !p; i++)
+        if (strncasecmp(g_profiles[i].name, stem, PROFILE_NAME_LEN) == 0)
+            p = &g_profiles[i];
+
+    if (p) {
+        if (strncmp(g_game, p->name, PROFILE_NAME_LEN) == 0) return;
+        memcpy(g_game, p->name, PROFILE_NAME_LEN);
+        g_game[PROFILE_NAME_LEN - 1] = '\0';
+        fprintf(stderr, "\nGame %s: using profile '%s'\n", name, g_game);
+    } else {
+        if (!dot || !is_game_file(dot + 1) || g_game[0] == '\0') return;
+        fprintf(stderr, "\nGame %s has no profile, using base mapping\n",
+                name);
+        g_game[0] = '\0';
+    }
+    Player *cur = g_player;
+    g_player = &g_players[0];
+    current_mapping(next);
+    swap_mapping(next);
+    g_player = cur;
+    STAT_ADD(profile_switches, 1);
+    print_mappings("Game key mappings");
+}
+
+static void game_handle(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(g_game_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *ie = (const struct inotify_event *)p;
+            p += sizeof(*ie) + ie->len;
+
+            if (ie->len == 0 || (ie->mask & IN_ISDIR)) continue;
+            if (g_suspended) continue;
+            game_opened(ie->name);
+        }
+    }
+}
+
+/* Ctrl+R from keyboard slot k: hand the player it feeds to the GUI
+ * thread. Only that player's outputs are released; the GUI thread
+ * stops the64, which it draws over, so that wait never holds up
+ * translation. */
+static void remap_begin(int k)
+{
+#ifdef K2J_NO_GUIMAP
+    (void)k;
+    fprintf(stderr, "\nCtrl+R ignored: this build has no remap GUI\n");
+#else
+    if (__atomic_load_n(&g_remap_active, __ATOMIC_RELAXED)) return;
+    int p = __builtin_ctz(g_kbd_players[k]);
+
+    fprintf(stderr, "\nCtrl+R pressed, entering remap mode...\n");
+    if (g_suspended) {
+        /* Translation resumes after the remap, so take the keyboards
+         * back now; the GUI gets its keys through us either way */
+        g_suspended = 0;
+        grab_keyboards();
+        drain_keyboard_events(g_kbd_rd, g_kbd_fds, g_num_kbd_fds);
+    }
+    Player *cur = g_player;
+    g_player = &g_players[p];
+    emit_release_all();
+    g_player = cur;
+    translate_flush();
+
+    __atomic_store_n(&g_remap_player, p, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_remap_active, 1, __ATOMIC_RELEASE);
+    STAT_ADD(remaps, 1);
+    kbd_mask_all();
+    merge_grab(0);     /* the GUI may navigate with it */
+
+    for (int q = 0; q < g_num_players; q++)
+        memcpy(g_remap_maps[q], g_players[q].map, sizeof(g_players[q].map));
+    gui_post(GUI_MSG_REMAP, p);
+#endif
+}
+
+/* While remapping, key presses from keyboard slot k go to the GUI if
+ * k feeds the player being remapped. Returns 1 if ev was taken. */
+static int remap_capture(int k, const struct input_event *ev)
+{
+    if (!__atomic_load_n(&g_remap_active, __ATOMIC_ACQUIRE) ||
+        !(g_kbd_players[k] &
+          (1u << __atomic_load_n(&g_remap_player, __ATOMIC_RELAXED))))
+        return 0;
+    if (ev->type == EV_KEY && ev->value == 1)
+        gui_post(GUI_MSG_KEY, ev->code);
+    return 1;
+}
+
+/* The GUI answered: install an applied mapping and resume */
+static void remap_finish(void)
+{
+    int i;
+
+    efd_ack(g_tr_efd);
+    while ((i = spsc_pop_slot(&g_to_tr, TR_SLOTS)) >= 0) {
+        const TrMsg *r = &g_to_tr_msg[i];
+
+        __atomic_store_n(&g_remap_active, 0, __ATOMIC_RELEASE);
+        g_ctrl_held = 0;   /* its release went to the GUI */
+        if (r->applied) {
+            /* An applied remap becomes the new base mapping */
+            Player *cur = g_player;
+            g_player = &g_players[r->player];
+            swap_mapping(r->map);
+            memcpy(g_player->base_map, r->map, sizeof(g_player->base_map));
+            if (r->player == 0)
+                g_game[0] = '\0';
+            g_player = cur;
+        } else {
+            kbd_mask_all();
+        }
+        spsc_pop_done(&g_to_tr);
+
+        if (!g_suspended)
+            merge_grab(1);
+        the64_start();
+        print_mappings("Updated key mappings");
+        fprintf(stderr, "\nResuming translation...\n");
+        fprintf(stderr, "Press Ctrl+S to pause/resume.\n");
+        fprintf(stderr, "Press Ctrl+R to remap.\n");
+        fprintf(stderr, "Press Ctrl+C to stop.\n\n");
+    }
+}
+
+/* The translation thread: sleep until a keyboard, signal, timer or
+ * GUI fd becomes readable */
+static void translate_loop(void)
+{
+    while (!__atomic_load_n(&g_quit, __ATOMIC_RELAXED)) {
+        if (g_dump_stats) {
+            g_dump_stats = 0;
+            latency_dump();
+        }
+        if (g_child_exited)
+            reap_children();
+        if (g_reload)
+            reload_config();
+
+        uint32_t ready[MAX_LOOP_FDS];
+        int nready = loop_wait(&g_loop, ready, MAX_LOOP_FDS, -1);
+        STAT_ADD(wakeups, 1);
+
+        for (int r = 0; r < nready; r++) {
+            if (LOOP_SRC(ready[r]) == SRC_SIGNAL) {
+                signals_drain();
+                continue;
+            }
+            if (LOOP_SRC(ready[r]) == SRC_HOTPLUG) {
+                hotplug_handle();
+                continue;
+            }
+            if (LOOP_SRC(ready[r]) == SRC_GAME) {
+                game_handle();
+                continue;
+            }
+            if (LOOP_SRC(ready[r]) == SRC_TIMER) {
+                timer_ack();
+                translate_tick(time_ns());
+                continue;
+            }
+            if (LOOP_SRC(ready[r]) == SRC_GUI) {
+                remap_finish();
+                continue;
+            }
+            if (LOOP_SRC(ready[r]) == SRC_JOY) {
+                if (g_joy_fd >= 0)
+                    merge_handle();
+                continue;
+            }
 
-        int found = 0;
-        for (int m = 0; m < NUM_MAPPINGS; m++) {
-            if (strcmp(argv[i], g_map[m].cli_name) == 0) {
-                if (i + 1 >= argc) {
-                    fprintf(stderr, "Error: %s requires a key name\n", argv[i]);
-                    return -1;
-                }
-                i++;
-                int kc = parse_keyname(argv[i]);
-                if (kc < 0) {
-                    fprintf(stderr, "Error: unknown key name '%s'\n", argv[i]);
-                    fprintf(stderr, "Run with --help for a list of key names\n");
-                    return -1;
+            int k = LOOP_IDX(ready[r]);
+            if (k >= g_num_kbd_fds) continue;  /* slot was dropped */
+
+            const struct input_event *ev;
+            int n, nev = 0;
+            g_lat_clock = g_kbd_rd[k].clock;
+            while ((n = ev_next(&g_kbd_rd[k], g_kbd_fds[k], &ev)) > 0) {
+                nev++;
+                if (g_record_fp)
+                    record_event(ev);
+                if (remap_capture(k, ev))
+                    continue;
+
+                switch (translate_event(ev, g_kbd_players[k])) {
+                case TR_SUSPEND:
+                    STAT_ADD(suspends, 1);
+                    ungrab_keyboards();
+                    merge_grab(0);
+                    fprintf(stderr, "\nJoystick emulation paused (Ctrl+S to resume)\n");
+                    break;
+                case TR_RESUME:
+                    grab_keyboards();
+                    drain_keyboard_events(g_kbd_rd, g_kbd_fds, g_num_kbd_fds);
+                    merge_grab(1);
+                    fprintf(stderr, "\nJoystick emulation resumed (Ctrl+S to pause)\n");
+                    break;
+                case TR_REMAP:
+                    /* Remap the player whose keyboard asked */
+                    remap_begin(k);
+                    break;
                 }
-                g_map[m].keycode = kc;
-                found = 1;
-                break;
             }
+            translate_flush();
+            STAT_ADD(events_in, nev);
+            STAT_ADD(kbd_events[k], nev);
+            if (n < 0)
+                drop_keyboard(k);
         }
-        if (!found) {
-            fprintf(stderr, "Error: unknown option '%s'\n", argv[i]);
-            fprintf(stderr, "Run with --help for usage information\n");
-            return -1;
-        }
+        timer_arm(translate_deadline());
     }
-    return 0;
 }
 
-/* ================================================================
- * Normal mode: main event loop
- * ================================================================ */
+static void *translate_thread(void *arg)
+{
+    (void)arg;
+    realtime_init();   /* this thread only: the GUI keeps normal priority */
+    translate_loop();
+    gui_post(GUI_MSG_QUIT, 0);
+    return NULL;
+}
 
 static int normal_run(void)
 {
-    struct input_event ev;
-
     /* Scan for keyboards */
-    g_num_kbd_fds = scan_keyboards(g_kbd_fds, MAX_KEYBOARDS);
-    if (g_num_kbd_fds == 0) {
+    g_num_kbd_fds = scan_keyboards(g_kbd_fds, g_kbd_nodes, MAX_KEYBOARDS);
+    for (int k = 0; k < g_num_kbd_fds && g_latency; k++)
+        g_kbd_rd[k].clock = latency_set_clock(g_kbd_fds[k]);
+    if (hotplug_init() < 0 && g_num_kbd_fds == 0) {
         fprintf(stderr, "Error: no USB keyboards found\n");
         return 1;
     }
-    fprintf(stderr, "Found %d keyboard(s)\n", g_num_kbd_fds);
-
-    /* Create virtual joystick */
-    g_uinput_fd = create_virtual_joystick();
-    if (g_uinput_fd < 0)
+    if (g_num_kbd_fds == 0)
+        fprintf(stderr, "No USB keyboards yet, waiting for one to be plugged in\n");
+    else
+        fprintf(stderr, "Found %d keyboard(s)\n", g_num_kbd_fds);
+
+    for (int k = 0; k < g_num_kbd_fds; k++)
+        assign_player(k);
+
+    /* One virtual joystick per player; wait for each device node
+     * rather than a fixed delay */
+    for (int p = 0; p < g_num_players; p++) {
+        g_players[p].uinput_fd = create_virtual_joystick();
+        if (g_players[p].uinput_fd < 0)
+            return 1;
+        wait_for_devnode(g_players[p].uinput_fd);
+    }
+    if (g_daemon && daemonize() < 0)
         return 1;
-
-    /* Allow time for device to be recognized */
-    usleep(500000);
+    stats_open();   /* after the fork, so it records our pid */
+    stats_keyboards(g_kbd_nodes, g_num_kbd_fds);
 
     /* Register cleanup */
     atexit(cleanup);
-    signal(SIGINT, sig_handler);
-    signal(SIGTERM, sig_handler);
+    if (g_record_path && record_open(g_record_path) < 0)
+        return 1;
+    signals_init();
+    signals_block();
 
     /* Grab keyboards */
     grab_keyboards();
-    drain_keyboard_events(g_kbd_fds, g_num_kbd_fds);
+    drain_keyboard_events(g_kbd_rd, g_kbd_fds, g_num_kbd_fds);
+
+    loop_init(&g_loop);
+    if (g_sig_fd >= 0)
+        loop_add(&g_loop, g_sig_fd, LOOP_TAG(SRC_SIGNAL, 0));
+    if (g_hotplug_fd >= 0)
+        loop_add(&g_loop, g_hotplug_fd, LOOP_TAG(SRC_HOTPLUG, 0));
+    if (game_watch_init() < 0)
+        return 1;
+    if (g_game_fd >= 0)
+        loop_add(&g_loop, g_game_fd, LOOP_TAG(SRC_GAME, 0));
+    if (timer_init() >= 0)
+        loop_add(&g_loop, g_timer_fd, LOOP_TAG(SRC_TIMER, 0));
+    if (threads_init() < 0)
+        return 1;
+    loop_add(&g_loop, g_tr_efd, LOOP_TAG(SRC_GUI, 0));
+    loop_add_keyboards();
+    if (g_merge_player >= 0) {
+        char node[KBD_NODE_LEN];
+        int fd = scan_joystick(node);
+        if (fd >= 0)
+            merge_attach(fd, node);
+        else
+            fprintf(stderr, "No joystick to merge yet, waiting for one to be plugged in\n");
+    }
+    for (int p = 0; p < g_num_players; p++)
+        memcpy(g_players[p].base_map, g_players[p].map, sizeof(g_players[p].map));
 
     /* Print active configuration */
-    fprintf(stderr, "\nActive key mappings:\n");
-    for (int i = 0; i < NUM_MAPPINGS; i++) {
-        fprintf(stderr, "  %-12s = %s\n",
-                g_map[i].label, keycode_to_name(g_map[i].keycode));
-    }
+    print_mappings("Active key mappings");
     fprintf(stderr, "\nTranslating keyboard input to THEJOYSTICK events...\n");
     fprintf(stderr, "Press Ctrl+S to pause/resume.\n");
+#ifndef K2J_NO_GUIMAP
     fprintf(stderr, "Press Ctrl+R to remap.\n");
+#endif
     fprintf(stderr, "Press Ctrl+C to stop.\n\n");
 
-    /* Outer loop: translate → remap → translate … */
-    for (;;) {
-        int remap_requested = 0;
-
-        /* Inner translation loop */
-        while (!g_quit) {
-            int axis_dirty = 0;
-
-            for (int k = 0; k < g_num_kbd_fds; k++) {
-                while (read(g_kbd_fds[k], &ev, sizeof(ev)) == (ssize_t)sizeof(ev)) {
-                    if (ev.type != EV_KEY) continue;
-                    if (ev.value == 2) continue;  /* skip autorepeat */
-
-                    int pressed = (ev.value == 1);
-
-                    /* Track Ctrl key state */
-                    if (ev.code == KEY_LEFTCTRL || ev.code == KEY_RIGHTCTRL) {
-                        g_ctrl_held = pressed;
-                        continue;
-                    }
-
-                    /* Ctrl+S → toggle suspend/resume */
-                    if (ev.code == KEY_S && pressed && g_ctrl_held) {
-                        if (!g_suspended) {
-                            for (int b = NUM_DIRECTIONS; b < NUM_MAPPINGS; b++)
-                                emit_event(g_uinput_fd, EV_KEY, g_map[b].btn_code, 0);
-                            emit_event(g_uinput_fd, EV_ABS, ABS_X, AXIS_CENTER);
-                            emit_event(g_uinput_fd, EV_ABS, ABS_Y, AXIS_CENTER);
-                            emit_syn(g_uinput_fd);
-                            memset(g_dir_held, 0, sizeof(g_dir_held));
-                            ungrab_keyboards();
-                            g_suspended = 1;
-                            fprintf(stderr, "\nJoystick emulation paused (Ctrl+S to resume)\n");
-                        } else {
-                            grab_keyboards();
-                            drain_keyboard_events(g_kbd_fds, g_num_kbd_fds);
-                            g_suspended = 0;
-                            g_ctrl_held = 0;
-                            fprintf(stderr, "\nJoystick emulation resumed (Ctrl+S to pause)\n");
-                        }
-                        continue;
-                    }
-
-                    /* Ctrl+R → request remap */
-                    if (ev.code == KEY_R && pressed && g_ctrl_held) {
-                        g_suspended = 0;
-                        remap_requested = 1;
-                        goto break_inner;
-                    }
-
-                    if (g_suspended) continue;
-
-                    /* Check direction mappings */
-                    for (int d = 0; d < NUM_DIRECTIONS; d++) {
-                        if (ev.code == g_map[d].keycode) {
-                            if (g_dir_held[d] != pressed) {
-                                g_dir_held[d] = pressed;
-                                axis_dirty = 1;
-                            }
-                        }
-                    }
+    /* Translation runs on its own thread; this one serves the GUI */
+    pthread_t tr;
+    int err = pthread_create(&tr, NULL, translate_thread, NULL);
+    if (err) {
+        fprintf(stderr, "Error: cannot start translation thread: %s\n",
+                strerror(err));
+        return 1;
+    }
+    gui_serve();
+    pthread_join(tr, NULL);
 
-                    /* Check button mappings */
-                    for (int b = NUM_DIRECTIONS; b < NUM_MAPPINGS; b++) {
-                        if (ev.code == g_map[b].keycode) {
-                            emit_event(g_uinput_fd, EV_MSC, MSC_SCAN,
-                                       0x90001 + (g_map[b].btn_code - BTN_TRIGGER));
-                            emit_event(g_uinput_fd, EV_KEY,
-                                       g_map[b].btn_code, pressed);
-                            emit_syn(g_uinput_fd);
-                        }
-                    }
-                }
-            }
+    fprintf(stderr, "\nShutting down...\n");
+    if (g_hotplug_fd >= 0) close(g_hotplug_fd);
+    game_watch_close();
+    if (g_timer_fd >= 0) close(g_timer_fd);
+    close(g_gui_efd);
+    close(g_tr_efd);
+    loop_destroy(&g_loop);
+    /* cleanup() called via atexit */
+    return 0;
+}
 
-            if (axis_dirty)
-                recalc_and_emit_axes();
+#ifndef K2J_NO_GUIMAP
 
-            usleep(1000);
-        }
-break_inner:
+/* ================================================================
+ * Directory browser (for guimap mode, from gamepad_map.c)
+ * ================================================================ */
 
-        if (g_quit) break;
+/* Listings of the last BROWSER_CACHE directories visited are kept,
+ * so going back up (or into a directory again) is instant. A listing
+ * is read a few milliseconds per frame by browser_step() and kept
+ * sorted as it grows, so a big directory on a slow USB stick never
+ * stalls the GUI. Only subdirectories are listed; d_type says which
+ * entries those are, with a stat() only when the filesystem does not
+ * report it (or for symlinks). Names live in one arena per listing. */
+#define BROWSER_CACHE     8
+#define BROWSER_STEP_NS   4000000   /* readdir() time per frame */
 
-        /* Ctrl+R was pressed — enter remap session */
-        fprintf(stderr, "\nCtrl+R pressed, entering remap mode...\n");
-        suspend_translation();
-        system("killall -9 the64");
-        system("killall -9 the64");
+typedef struct {
+    char     *path;        /* NULL: unused slot */
+    struct timespec mtime; /* of the directory when it was read */
+    char     *names;       /* arena of NUL-terminated names */
+    size_t    names_len, names_cap;
+    uint32_t *off;         /* sorted: offset of each name in names */
+    int       count, cap;
+    DIR      *dir;         /* still being read, NULL once complete */
+    uint64_t  used;        /* LRU stamp */
+} DirListing;
 
-        /* Save current mappings so we can restore on quit-without-apply */
-        Mapping saved_map[NUM_MAPPINGS];
-        memcpy(saved_map, g_map, sizeof(g_map));
+typedef struct {
+    char        path[MAX_PATH_LEN];
+    DirListing  cache[BROWSER_CACHE];
+    DirListing *cur;
+    uint64_t    clock;
+    int         selected;
+    int         scroll;
+} DirBrowser;
 
-        int remap_result = guimap_run();
-        if (remap_result != 0)
-            memcpy(g_map, saved_map, sizeof(g_map));
+static const char BROWSER_EXPORT[] = ">> Export here <<";
 
-        system("the64 &");
-        //usleep(500000);
+static void listing_free(DirListing *l)
+{
+    if (l->dir) closedir(l->dir);
+    free(l->path);
+    free(l->names);
+    free(l->off);
+    memset(l, 0, sizeof(*l));
+}
 
-        /* Print updated configuration */
-        fprintf(stderr, "\nUpdated key mappings:\n");
-        for (int i = 0; i < NUM_MAPPINGS; i++) {
-            fprintf(stderr, "  %-12s = %s\n",
-                    g_map[i].label, keycode_to_name(g_map[i].keycode));
-        }
+static void browser_free(DirBrowser *b)
+{
+    for (int i = 0; i < BROWSER_CACHE; i++)
+        listing_free(&b->cache[i]);
+    b->cur = NULL;
+}
 
-        /* Re-scan and re-grab keyboards */
-        g_num_kbd_fds = scan_keyboards(g_kbd_fds, MAX_KEYBOARDS);
-        grab_keyboards();
-        drain_keyboard_events(g_kbd_fds, g_num_kbd_fds);
+/* Rows: ".." (except at /), the subdirectories, then the export row */
+static int browser_has_parent(const DirBrowser *b)
+{
+    return strcmp(b->path, "/") != 0;
+}
 
-        fprintf(stderr, "\nResuming translation...\n");
-        fprintf(stderr, "Press Ctrl+S to pause/resume.\n");
-        fprintf(stderr, "Press Ctrl+R to remap.\n");
-        fprintf(stderr, "Press Ctrl+C to stop.\n\n");
+static int browser_count(const DirBrowser *b)
+{
+    return browser_has_parent(b) + (b->cur ? b->cur->count : 0) + 1;
+}
 
-        (void)remap_requested;
+/* Name of row i; *is_dir is 0 only for the export row */
+static const char *browser_entry(const DirBrowser *b, int i, int *is_dir)
+{
+    *is_dir = 1;
+    if (browser_has_parent(b)) {
+        if (i == 0) return "..";
+        i--;
     }
-
-    fprintf(stderr, "\nShutting down...\n");
-    /* cleanup() called via atexit */
-    return 0;
+    if (b->cur && i < b->cur->count)
+        return b->cur->names + b->cur->off[i];
+    *is_dir = 0;
+    return BROWSER_EXPORT;
 }
 
-/* ================================================================
- * Directory browser (for guimap mode, from gamepad_map.c)
- * ================================================================ */
+/* Insert name in sorted position; 0 on allocation failure */
+static int listing_add(DirBrowser *b, const char *name)
+{
+    DirListing *l = b->cur;
+    size_t len = strlen(name) + 1;
+
+    if (l->names_len + len > l->names_cap) {
+        size_t cap = l->names_cap ? l->names_cap * 2 : 4096;
+        while (cap < l->names_len + len) cap *= 2;
+        char *p = realloc(l->names, cap);
+        if (!p) return 0;
+        l->names = p;
+        l->names_cap = cap;
+    }
+    if (l->count == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        uint32_t *p = realloc(l->off, cap * sizeof(*p));
+        if (!p) return 0;
+        l->off = p;
+        l->cap = cap;
+    }
 
-typedef struct {
-    char name[MAX_NAME_LEN];
-    int  is_dir;
-} DirEntry;
+    int lo = 0, hi = l->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcasecmp(l->names + l->off[mid], name) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    memcpy(l->names + l->names_len, name, len);
+    memmove(&l->off[lo + 1], &l->off[lo], (l->count - lo) * sizeof(l->off[0]));
+    l->off[lo] = (uint32_t)l->names_len;
+    l->names_len += len;
+    l->count++;
+
+    /* Keep the highlight on the same row while rows appear above it;
+     * the new row is lo, after ".." when there is one */
+    if (browser_has_parent(b) + lo <= b->selected)
+        b->selected++;
+    return 1;
+}
 
-typedef struct {
-    char     path[MAX_PATH_LEN];
-    DirEntry entries[MAX_DIR_ENTRIES];
-    int      count;
-    int      selected;
-    int      scroll;
-} DirBrowser;
+static int browser_loading(const DirBrowser *b)
+{
+    return b->cur && b->cur->dir;
+}
 
-static int dir_entry_cmp(const void *a, const void *b)
+/* Read more of the current listing for up to BROWSER_STEP_NS.
+ * Returns 1 if it did (so the rows need a redraw), 0 if complete. */
+static int browser_step(DirBrowser *b)
 {
-    const DirEntry *da = a, *db = b;
-    if (da->is_dir != db->is_dir)
-        return db->is_dir - da->is_dir;
-    return strcasecmp(da->name, db->name);
+    DirListing *l = b->cur;
+    struct dirent *entry;
+    struct stat st;
+    uint64_t until = time_ns() + BROWSER_STEP_NS;
+
+    if (!browser_loading(b)) return 0;
+    while ((entry = readdir(l->dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;   /* and hidden dirs */
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+            is_dir = fstatat(dirfd(l->dir), entry->d_name, &st, 0) == 0 &&
+                     S_ISDIR(st.st_mode);
+        if (is_dir && !listing_add(b, entry->d_name))
+            break;
+        if (time_ns() >= until)
+            return 1;
+    }
+    closedir(l->dir);
+    l->dir = NULL;
+    return 1;
 }
 
 static void browser_load(DirBrowser *b, const char *path)
 {
-    DIR *dir;
-    struct dirent *entry;
+    DirListing *l = NULL, *lru = &b->cache[0];
     struct stat st;
-    char fullpath[MAX_PATH_LEN];
+    int have_st = stat(path, &st) == 0;
 
-    strncpy(b->path, path, MAX_PATH_LEN - 1);
-    b->path[MAX_PATH_LEN - 1] = '\0';
-    b->count = 0;
+    if (path != b->path)
+        snprintf(b->path, sizeof(b->path), "%s", path);
     b->selected = 0;
     b->scroll = 0;
 
-    if (strcmp(b->path, "/") != 0) {
-        strcpy(b->entries[0].name, "..");
-        b->entries[0].is_dir = 1;
-        b->count = 1;
+    for (int i = 0; i < BROWSER_CACHE; i++) {
+        DirListing *c = &b->cache[i];
+        if (c->path && strcmp(c->path, b->path) == 0) {
+            l = c;
+            break;
+        }
+        if (!c->path || (lru->path && c->used < lru->used))
+            lru = c;
     }
-
-    dir = opendir(path);
-    if (!dir) return;
-
-    while ((entry = readdir(dir)) != NULL && b->count < MAX_DIR_ENTRIES) {
-        if (entry->d_name[0] == '.') continue;
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", path, entry->d_name);
-        if (stat(fullpath, &st) < 0) continue;
-        if (!S_ISDIR(st.st_mode)) continue;
-
-        snprintf(b->entries[b->count].name,
-                 sizeof(b->entries[b->count].name), "%s", entry->d_name);
-        b->entries[b->count].is_dir = 1;
-        b->count++;
+    /* A cached listing is reused unless the directory has changed */
+    if (l && !l->dir && (!have_st ||
+                         st.st_mtim.tv_sec != l->mtime.tv_sec ||
+                         st.st_mtim.tv_nsec != l->mtime.tv_nsec)) {
+        listing_free(l);
+        lru = l;
+        l = NULL;
     }
-    closedir(dir);
-
-    int start = (b->count > 0 && strcmp(b->entries[0].name, "..") == 0) ? 1 : 0;
-    if (b->count - start > 1)
-        qsort(&b->entries[start], b->count - start, sizeof(DirEntry),
-              dir_entry_cmp);
-
-    if (b->count < MAX_DIR_ENTRIES) {
-        snprintf(b->entries[b->count].name,
-                 sizeof(b->entries[b->count].name), ">> Export here <<");
-        b->entries[b->count].is_dir = 0;
-        b->count++;
+    if (!l) {
+        l = lru;
+        listing_free(l);
+        l->path = strdup(b->path);
+        if (have_st) l->mtime = st.st_mtim;
+        l->dir = opendir(b->path);
     }
+    l->used = ++b->clock;
+    b->cur = l;
+    browser_step(b);
 }
 
 /* ================================================================
@@ -1280,6 +4741,112 @@ static void draw_joystick_guimap(Framebuffer *fb, int ox, int oy,
     draw_text_centered(fb, ox + 220, oy + 190, "Stick", COL_TEXT_DIM, 1);
 }
 
+/* The graphic above is drawn once per guimap session instead of every
+ * frame: an offscreen copy with nothing highlighted, plus for each
+ * (highlight, blink) pair the runs of pixels where that picture
+ * differs from it. Drawing a frame is then a blit and a few recoloured
+ * spans. The runs come from rendering every pair and diffing, so they
+ * match draw_joystick_guimap() exactly without restating its shapes. */
+#define MAX_JOY_SPANS  4096
+
+typedef struct {
+    uint16_t x, y, len;
+    uint32_t c;
+} JoySpan;
+
+typedef struct {
+    uint32_t *base;       /* JOY_W x JOY_H on COL_BG, NULL if not built */
+    JoySpan  *spans;
+    int       first[NUM_MAPPINGS][2];   /* by highlight index and blink */
+    int       count[NUM_MAPPINGS][2];
+} JoyArt;
+
+static void joy_art_free(JoyArt *a)
+{
+    free(a->base);
+    free(a->spans);
+    a->base  = NULL;
+    a->spans = NULL;
+}
+
+/* Build the layer; on failure (no memory, too many spans) a->base is
+ * NULL and joy_art_draw() falls back to drawing directly */
+static void joy_art_init(JoyArt *a)
+{
+    Framebuffer layer;
+    uint32_t *scratch;
+    int n = 0;
+
+    memset(a, 0, sizeof(*a));
+    memset(&layer, 0, sizeof(layer));
+    layer.width = layer.stride_px = JOY_W;
+    layer.height = JOY_H;
+
+    a->base  = malloc((size_t)JOY_W * JOY_H * sizeof(uint32_t));
+    a->spans = malloc(MAX_JOY_SPANS * sizeof(JoySpan));
+    scratch  = malloc((size_t)JOY_W * JOY_H * sizeof(uint32_t));
+    if (!a->base || !a->spans || !scratch)
+        goto fail;
+
+    layer.backbuf = a->base;
+    draw_rect(&layer, 0, 0, JOY_W, JOY_H, COL_BG);
+    draw_joystick_guimap(&layer, 0, 0, -1, 0);
+
+    layer.backbuf = scratch;
+    for (int i = 0; i < NUM_MAPPINGS; i++) {
+        for (int blink = 0; blink < 2; blink++) {
+            draw_rect(&layer, 0, 0, JOY_W, JOY_H, COL_BG);
+            draw_joystick_guimap(&layer, 0, 0, i, blink);
+            a->first[i][blink] = n;
+            for (int y = 0; y < JOY_H; y++) {
+                const uint32_t *b = a->base + (size_t)y * JOY_W;
+                const uint32_t *h = scratch + (size_t)y * JOY_W;
+                for (int x = 0; x < JOY_W; ) {
+                    if (h[x] == b[x]) { x++; continue; }
+                    int x0 = x;
+                    while (x < JOY_W && h[x] != b[x] && h[x] == h[x0]) x++;
+                    if (n == MAX_JOY_SPANS)
+                        goto fail;
+                    a->spans[n++] = (JoySpan){ (uint16_t)x0, (uint16_t)y,
+                                               (uint16_t)(x - x0), h[x0] };
+                }
+            }
+            a->count[i][blink] = n - a->first[i][blink];
+        }
+    }
+    free(scratch);
+    return;
+
+fail:
+    fprintf(stderr, "Warning: drawing the joystick without a cached layer\n");
+    free(scratch);
+    joy_art_free(a);
+}
+
+static void joy_art_draw(Framebuffer *fb, const JoyArt *a, int ox, int oy,
+                         int highlight_idx, int blink)
+{
+    if (!a->base) {
+        draw_joystick_guimap(fb, ox, oy, highlight_idx, blink);
+        return;
+    }
+
+    int x0 = ox < 0 ? -ox : 0;
+    int x1 = ox + JOY_W > fb->width ? fb->width - ox : JOY_W;
+    for (int y = 0; y < JOY_H && x1 > x0; y++) {
+        if (oy + y < 0 || oy + y >= fb->height) continue;
+        memcpy(fb->backbuf + (size_t)(oy + y) * fb->stride_px + ox + x0,
+               a->base + (size_t)y * JOY_W + x0,
+               (size_t)(x1 - x0) * sizeof(uint32_t));
+    }
+
+    if (highlight_idx < 0 || highlight_idx >= NUM_MAPPINGS) return;
+    blink = !!blink;
+    const JoySpan *sp = a->spans + a->first[highlight_idx][blink];
+    for (int i = 0; i < a->count[highlight_idx][blink]; i++)
+        draw_rect(fb, ox + sp[i].x, oy + sp[i].y, sp[i].len, 1, sp[i].c);
+}
+
 /* ================================================================
  * Guimap mode
  * ================================================================ */
@@ -1296,16 +4863,26 @@ static void draw_joystick_guimap(Framebuffer *fb, int ox, int oy,
 
 typedef struct {
     Framebuffer fb;
+    JoyArt      joy;
     int         state;
     int         cur_map;
     int         redo_single;
     int         review_sel;
     int         blink;
     uint64_t    blink_time;
+    int         dirty;        /* full redraw needed */
+    int         blink_dirty;  /* only the blinking elements changed */
+    uint64_t    debounce_until; /* ignore keys until then, 0 = off */
     DirBrowser  browser;
     char        save_path[MAX_PATH_LEN];
     int         kbd_fds[MAX_KEYBOARDS];
+    EvReader    kbd_rd[MAX_KEYBOARDS];
     int         num_kbd_fds;
+    int         remote;       /* keys come from the translation thread */
+    int         quit;         /* it asked us to stop */
+    Mapping   (*maps)[NUM_MAPPINGS];  /* every player's mapping */
+    Mapping    *map;          /* the one being edited: maps[player] */
+    int         player;
     int         mapped[NUM_MAPPINGS]; /* 1 if this mapping has been set */
     int         applied;
     int         joy_fd;       /* real joystick fd, or -1 */
@@ -1313,63 +4890,9 @@ typedef struct {
 } GuimapApp;
 
 /* ================================================================
- * Joystick scanning / navigation helpers (for guimap review/browse)
+ * Joystick navigation helpers (for guimap review/browse)
  * ================================================================ */
 
-static int scan_joystick(void)
-{
-    DIR *dir;
-    struct dirent *entry;
-    char path[MAX_PATH_LEN];
-    char name[MAX_NAME_LEN];
-
-    dir = opendir("/dev/input");
-    if (!dir) return -1;
-
-    while ((entry = readdir(dir)) != NULL) {
-        if (strlen(entry->d_name) <= 5) continue;
-        if (strncmp(entry->d_name, "event", 5) != 0) continue;
-
-        snprintf(path, sizeof(path), "/dev/input/%s", entry->d_name);
-        int fd = open(path, O_RDONLY | O_NONBLOCK);
-        if (fd < 0) continue;
-
-        unsigned long evbits[NBITS(EV_MAX)];
-        unsigned long absbits[NBITS(ABS_MAX)];
-        unsigned long keybits[NBITS(KEY_MAX)];
-        memset(evbits, 0, sizeof(evbits));
-        if (ioctl(fd, EVIOCGBIT(0, sizeof(evbits)), evbits) < 0) {
-            close(fd); continue;
-        }
-        if (!TEST_BIT(EV_ABS, evbits) || !TEST_BIT(EV_KEY, evbits)) {
-            close(fd); continue;
-        }
-        memset(absbits, 0, sizeof(absbits));
-        ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits);
-        if (!TEST_BIT(ABS_X, absbits) || !TEST_BIT(ABS_Y, absbits)) {
-            close(fd); continue;
-        }
-        memset(keybits, 0, sizeof(keybits));
-        ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits);
-        if (!TEST_BIT(BTN_TRIGGER, keybits)) {
-            close(fd); continue;
-        }
-
-        /* Skip our own virtual joystick */
-        memset(name, 0, sizeof(name));
-        ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
-        if (strcmp(name, VDEV_NAME) == 0) {
-            close(fd); continue;
-        }
-
-        closedir(dir);
-        fprintf(stderr, "Found joystick for nav: %s (%s)\n", name, path);
-        return fd;
-    }
-    closedir(dir);
-    return -1;
-}
-
 static void read_joystick_nav(int joy_fd, int *prev_y,
                                int *nav_dy, int *nav_confirm)
 {
@@ -1413,10 +4936,27 @@ static void guimap_save_script(GuimapApp *gapp)
     }
 
     fprintf(fp, "#!/bin/sh\nexec ./keyboard2thejoystick");
-    for (int i = 0; i < NUM_MAPPINGS; i++) {
-        const char *kn = keycode_to_name(g_map[i].keycode);
-        /* Put continuation backslash before each option */
-        fprintf(fp, " \\\n  %s %s", g_map[i].cli_name, kn);
+    if (g_split)
+        fprintf(fp, " --split");
+    for (int p = 0; p < g_num_players; p++) {
+        const Mapping *map = gapp->maps[p];
+        const Player *pl = &g_players[p];   /* macros are fixed at startup */
+
+        if (g_num_players > 1)
+            fprintf(fp, " \\\n  --player %d", p + 1);
+        for (int i = 0; i < NUM_MAPPINGS; i++) {
+            const char *kn = keycode_to_name(map[i].keycode);
+            /* Put continuation backslash before each option */
+            fprintf(fp, " \\\n  %s %s", map[i].cli_name, kn);
+        }
+        for (int b = NUM_DIRECTIONS; b < NUM_MAPPINGS; b++) {
+            if (map[b].turbo_hz)
+                fprintf(fp, " \\\n  --turbo %s:%d", map[b].cli_name + 2,
+                        map[b].turbo_hz);
+        }
+        for (int i = 0; i < g_num_macros; i++)
+            if (pl->macro_key[g_macros[i].keycode] == i + 1)
+                fprintf(fp, " \\\n  --macro %s", g_macros[i].spec);
     }
     fprintf(fp, "\n");
     fclose(fp);
@@ -1425,38 +4965,70 @@ static void guimap_save_script(GuimapApp *gapp)
     snprintf(gapp->save_path, sizeof(gapp->save_path), "%s", filepath);
 }
 
+/* Mapping screen layout */
+#define MAP_JOY_Y       50
+#define MAP_PROMPT_Y    (MAP_JOY_Y + JOY_H + 20)
+#define MAP_PROMPT_H    (FONT_H * 2)
+
+static void guimap_render_map_joystick(GuimapApp *gapp)
+{
+    Framebuffer *fb = &gapp->fb;
+    joy_art_draw(fb, &gapp->joy, fb->width / 2 - JOY_W / 2, MAP_JOY_Y,
+                 gapp->cur_map, gapp->blink);
+}
+
+static void guimap_render_map_prompt(GuimapApp *gapp)
+{
+    Framebuffer *fb = &gapp->fb;
+    char buf[256];
+
+    snprintf(buf, sizeof(buf), ">>> Press key for: %s <<<",
+             gapp->map[gapp->cur_map].label);
+    draw_text_centered(fb, fb->width / 2, MAP_PROMPT_Y, buf,
+                        gapp->blink ? COL_HIGHLIGHT : COL_TEXT, 2);
+}
+
+/* Blink toggle on the mapping screen: redraw just the joystick and
+ * the prompt instead of the whole frame */
+static void guimap_render_map_blink(GuimapApp *gapp)
+{
+    Framebuffer *fb = &gapp->fb;
+
+    /* The joystick blit covers its whole box, so no clear is needed */
+    fb_damage(fb, fb->width / 2 - JOY_W / 2, MAP_JOY_Y, JOY_W, JOY_H);
+    guimap_render_map_joystick(gapp);
+    fb_clear_rect(fb, 0, MAP_PROMPT_Y, fb->width, MAP_PROMPT_H, COL_BG);
+    guimap_render_map_prompt(gapp);
+}
+
 static void guimap_render_map(GuimapApp *gapp)
 {
     Framebuffer *fb = &gapp->fb;
-    int cx = fb->width / 2;
     char buf[256];
 
     /* Header */
     draw_rect(fb, 0, 0, fb->width, 36, COL_HEADER_BG);
-    snprintf(buf, sizeof(buf), "Keyboard Mapping (%d/%d)",
-             gapp->cur_map + 1, NUM_MAPPINGS);
+    if (g_num_players > 1)
+        snprintf(buf, sizeof(buf), "Player %d Keyboard Mapping (%d/%d)",
+                 gapp->player + 1, gapp->cur_map + 1,
+                 NUM_MAPPINGS);
+    else
+        snprintf(buf, sizeof(buf), "Keyboard Mapping (%d/%d)",
+                 gapp->cur_map + 1, NUM_MAPPINGS);
     draw_text(fb, 16, 10, buf, COL_TEXT_TITLE, 1);
 
-    /* Joystick graphic */
-    int jx = cx - JOY_W / 2;
-    int jy = 50;
-    draw_joystick_guimap(fb, jx, jy, gapp->cur_map, gapp->blink);
-
-    /* Prompt */
-    int py = jy + JOY_H + 20;
-    snprintf(buf, sizeof(buf), ">>> Press key for: %s <<<",
-             g_map[gapp->cur_map].label);
-    draw_text_centered(fb, cx, py, buf,
-                        gapp->blink ? COL_HIGHLIGHT : COL_TEXT, 2);
+    /* Joystick graphic and prompt */
+    guimap_render_map_joystick(gapp);
+    guimap_render_map_prompt(gapp);
 
     /* Already mapped summary */
-    int sy = py + 50;
+    int sy = MAP_PROMPT_Y + 50;
     draw_text(fb, 100, sy, "Mapped so far:", COL_TEXT_DIM, 1);
     sy += 20;
     for (int i = 0; i < gapp->cur_map; i++) {
         if (!gapp->mapped[i]) continue;
         snprintf(buf, sizeof(buf), "  %-12s = %s",
-                 g_map[i].label, keycode_to_name(g_map[i].keycode));
+                 gapp->map[i].label, keycode_to_name(gapp->map[i].keycode));
         draw_text(fb, 100, sy, buf, COL_MAPPED, 1);
         sy += 18;
     }
@@ -1477,7 +5049,7 @@ static void guimap_render_review(GuimapApp *gapp)
     int has_dupes = 0;
     for (int i = 0; i < NUM_MAPPINGS && !has_dupes; i++)
         for (int j = i + 1; j < NUM_MAPPINGS; j++)
-            if (g_map[j].keycode == g_map[i].keycode) { has_dupes = 1; break; }
+            if (gapp->map[j].keycode == gapp->map[i].keycode) { has_dupes = 1; break; }
 
     /* Column headers */
     draw_text(fb, 60, y, "Action", COL_TEXT_DIM, 1);
@@ -1495,24 +5067,24 @@ static void guimap_render_review(GuimapApp *gapp)
         if (hl)
             draw_rect(fb, 50, y - 2, fb->width - 100, 22, COL_SELECTED);
 
-        draw_text(fb, 60, y, g_map[i].label,
+        draw_text(fb, 60, y, gapp->map[i].label,
                   hl ? COL_TEXT_TITLE : COL_TEXT, 1);
-        draw_text(fb, 260, y, keycode_to_name(g_map[i].keycode),
+        draw_text(fb, 260, y, keycode_to_name(gapp->map[i].keycode),
                   hl ? COL_TEXT_TITLE : COL_MAPPED, 1);
 
         if (i < NUM_DIRECTIONS)
-            snprintf(buf, sizeof(buf), "Stick %s", g_map[i].label);
+            snprintf(buf, sizeof(buf), "Stick %s", gapp->map[i].label);
         else
-            snprintf(buf, sizeof(buf), "BTN_%d", g_map[i].btn_code);
+            snprintf(buf, sizeof(buf), "BTN_%d", gapp->map[i].btn_code);
         draw_text(fb, 460, y, buf, COL_TEXT_DIM, 1);
 
         if (has_dupes) {
             char dups[256] = "";
             for (int j = 0; j < NUM_MAPPINGS; j++) {
                 if (j == i) continue;
-                if (g_map[j].keycode == g_map[i].keycode) {
+                if (gapp->map[j].keycode == gapp->map[i].keycode) {
                     if (dups[0]) strncat(dups, ", ", sizeof(dups) - strlen(dups) - 1);
-                    strncat(dups, g_map[j].label, sizeof(dups) - strlen(dups) - 1);
+                    strncat(dups, gapp->map[j].label, sizeof(dups) - strlen(dups) - 1);
                 }
             }
             if (dups[0]) draw_text(fb, 660, y, dups, COL_ERROR, 1);
@@ -1565,13 +5137,14 @@ static void guimap_render_browse(GuimapApp *gapp)
 {
     Framebuffer *fb = &gapp->fb;
     DirBrowser *b = &gapp->browser;
-    char buf[512];
+    char buf[MAX_PATH_LEN + 64];   /* path plus the label around it */
 
     draw_rect(fb, 0, 0, fb->width, 36, COL_HEADER_BG);
     draw_text(fb, 16, 10, "Select Export Directory", COL_TEXT_TITLE, 1);
 
     int y = 50;
-    snprintf(buf, sizeof(buf), "Current: %s/", b->path);
+    snprintf(buf, sizeof(buf), "Current: %s/%s", b->path,
+             browser_loading(b) ? "  (reading...)" : "");
     draw_text(fb, 60, y, buf, COL_TEXT, 1);
 
     y += 30;
@@ -1579,17 +5152,20 @@ static void guimap_render_browse(GuimapApp *gapp)
     y += 8;
 
     int visible = 18;
-    for (int i = b->scroll; i < b->count && i < b->scroll + visible; i++) {
+    int count = browser_count(b);
+    for (int i = b->scroll; i < count && i < b->scroll + visible; i++) {
         int hl = (i == b->selected);
+        int is_dir;
+        const char *name = browser_entry(b, i, &is_dir);
         if (hl)
             draw_rect(fb, 50, y - 2, fb->width - 100, 22, COL_SELECTED);
 
-        if (b->entries[i].is_dir) {
-            snprintf(buf, sizeof(buf), "[%s]", b->entries[i].name);
+        if (is_dir) {
+            snprintf(buf, sizeof(buf), "[%.500s]", name);
             draw_text(fb, 70, y, buf,
                       hl ? COL_TEXT_TITLE : COL_TEXT, 1);
         } else {
-            draw_text(fb, 70, y, b->entries[i].name,
+            draw_text(fb, 70, y, name,
                       hl ? COL_TEXT_TITLE : COL_SUCCESS, 1);
         }
         y += 24;
@@ -1608,53 +5184,189 @@ static void guimap_render_browse(GuimapApp *gapp)
     draw_text(fb, 60, hy, buf, COL_TEXT_DIM, 1);
 }
 
-static int guimap_run(void)
+/* Key presses come from our own keyboard fds in --guimap mode and
+ * from the translation thread during a Ctrl+R remap */
+static int guimap_read_key(GuimapApp *gapp)
+{
+    GuiMsg m;
+
+    if (!gapp->remote)
+        return read_keyboard_press(gapp->kbd_rd, gapp->kbd_fds,
+                                   gapp->num_kbd_fds);
+    while (gui_recv(&m)) {
+        if (m.kind == GUI_MSG_KEY)
+            return m.arg;
+        if (m.kind == GUI_MSG_QUIT)
+            gapp->quit = 1;
+    }
+    return 0;
+}
+
+static void guimap_drain(GuimapApp *gapp)
+{
+    GuiMsg m;
+
+    if (!gapp->remote) {
+        drain_keyboard_events(gapp->kbd_rd, gapp->kbd_fds, gapp->num_kbd_fds);
+        return;
+    }
+    while (gui_recv(&m))
+        if (m.kind == GUI_MSG_QUIT)
+            gapp->quit = 1;
+}
+
+/* Key presses already read but not yet handed out: events left in an
+ * EvReader by read_keyboard_press(), or messages after the one
+ * guimap_read_key() took. Neither wakes ppoll(). */
+static int guimap_pending(const GuimapApp *gapp)
+{
+    if (gapp->remote)
+        return spsc_pop_slot(&g_to_gui, GUI_SLOTS) >= 0;
+    for (int i = 0; i < gapp->num_kbd_fds; i++)
+        if (gapp->kbd_rd[i].head < gapp->kbd_rd[i].len)
+            return 1;
+    return 0;
+}
+
+/* Sleep until a keyboard (or the translation thread) or the joystick
+ * has input, or until the next blink toggle / end of the key debounce
+ * window. Returns at once if guimap_pending(). In --guimap mode
+ * SIGINT/SIGTERM are only unblocked inside ppoll() so g_quit cannot
+ * be missed. */
+static void guimap_wait(GuimapApp *gapp, const sigset_t *wait_mask)
+{
+    struct pollfd pfds[MAX_KEYBOARDS + 1];
+    int n = 0, joy = -1;
+    uint64_t now = time_ms();
+    uint64_t deadline = 0;
+    struct timespec ts, *tsp = NULL;
+
+    for (int i = 0; i < gapp->num_kbd_fds; i++) {
+        pfds[n].fd = gapp->kbd_fds[i];
+        pfds[n].events = POLLIN;
+        n++;
+    }
+    if (gapp->remote) {
+        pfds[n].fd = g_gui_efd;
+        pfds[n].events = POLLIN;
+        n++;
+    }
+    /* The joystick is only read on the review/browse screens */
+    if (gapp->joy_fd >= 0 && gapp->state != GUIMAP_MAP) {
+        joy = n;
+        pfds[n].fd = gapp->joy_fd;
+        pfds[n].events = POLLIN;
+        n++;
+    }
+
+    if (gapp->state == GUIMAP_MAP)
+        deadline = gapp->blink_time + BLINK_MS + 1;
+    if (gapp->state == GUIMAP_BROWSE && browser_loading(&gapp->browser))
+        deadline = now;   /* keep reading the directory */
+    if (gapp->debounce_until && (!deadline || gapp->debounce_until < deadline))
+        deadline = gapp->debounce_until;
+    if (guimap_pending(gapp))
+        deadline = now;
+    if (deadline) {
+        uint64_t ms = deadline > now ? deadline - now : 0;
+        ts.tv_sec  = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000;
+        tsp = &ts;
+    }
+
+    if (ppoll(pfds, n, tsp, wait_mask) <= 0)
+        return;
+    if (gapp->remote && (pfds[gapp->num_kbd_fds].revents & POLLIN))
+        efd_ack(g_gui_efd);
+
+    /* Forget keyboards that were unplugged, or poll() would spin */
+    for (int i = gapp->num_kbd_fds - 1; i >= 0; i--) {
+        if (!(pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL))) continue;
+        close(gapp->kbd_fds[i]);
+        gapp->kbd_fds[i] = gapp->kbd_fds[--gapp->num_kbd_fds];
+        gapp->kbd_rd[i]  = gapp->kbd_rd[gapp->num_kbd_fds];
+    }
+    if (joy >= 0 && (pfds[joy].revents & (POLLERR | POLLHUP | POLLNVAL))) {
+        close(gapp->joy_fd);
+        gapp->joy_fd = -1;
+    }
+}
+
+/* Map player's inputs in maps[player], leaving the result there.
+ * remote: run as the remap GUI thread, with keys from the translation
+ * thread, rather than as --guimap with keyboards of our own.
+ * Returns 0 if applied, 1 if not, -1 if the translation thread quit. */
+static int guimap_run(int player, Mapping (*maps)[NUM_MAPPINGS], int remote)
 {
     GuimapApp gapp;
     memset(&gapp, 0, sizeof(gapp));
+    gapp.remote = remote;
+    gapp.maps   = maps;
+    gapp.map    = maps[player];
+    gapp.player = player;
 
     if (fb_init(&gapp.fb) < 0) {
         fprintf(stderr, "Failed to initialize framebuffer\n");
         return 1;
     }
 
-    gapp.num_kbd_fds = scan_keyboards(gapp.kbd_fds, MAX_KEYBOARDS);
-    if (gapp.num_kbd_fds == 0) {
-        fprintf(stderr, "Error: no USB keyboards found\n");
-        fb_destroy(&gapp.fb);
-        return 1;
+    joy_art_init(&gapp.joy);
+
+    sigset_t orig_mask, wait_mask, *waitp = NULL;
+    if (remote) {
+        guimap_drain(&gapp);   /* the rest of the Ctrl+R chord */
+    } else {
+        gapp.num_kbd_fds = scan_keyboards(gapp.kbd_fds, NULL, MAX_KEYBOARDS);
+        if (gapp.num_kbd_fds == 0) {
+            fprintf(stderr, "Error: no USB keyboards found\n");
+            joy_art_free(&gapp.joy);
+            fb_destroy(&gapp.fb);
+            return 1;
+        }
+        signals_init();
+        sigprocmask(SIG_BLOCK, &g_sig_mask, &orig_mask);
+        wait_mask = orig_mask;
+        sigdelset(&wait_mask, SIGINT);
+        sigdelset(&wait_mask, SIGTERM);
+        waitp = &wait_mask;
     }
 
-    signal(SIGINT, sig_handler);
-    signal(SIGTERM, sig_handler);
-
     gapp.state = GUIMAP_MAP;
     gapp.cur_map = 0;
     gapp.redo_single = -1;
     gapp.review_sel = 0;
     gapp.blink_time = time_ms();
-    gapp.joy_fd = scan_joystick();
+    gapp.dirty = 1;
+    gapp.joy_fd = scan_joystick(NULL);
     gapp.joy_prev_y = 0;
 
     /* Main loop */
-    while (!g_quit) {
+    while (!__atomic_load_n(&g_quit, __ATOMIC_RELAXED) && !gapp.quit) {
         uint64_t now = time_ms();
 
         if (now - gapp.blink_time > BLINK_MS) {
             gapp.blink = !gapp.blink;
             gapp.blink_time = now;
+            gapp.blink_dirty = 1;
+        }
+
+        /* Swallow everything typed right after a key was mapped */
+        if (gapp.debounce_until) {
+            guimap_drain(&gapp);
+            if (now < gapp.debounce_until) goto render;
+            gapp.debounce_until = 0;
         }
 
         /* Update logic */
         if (gapp.state == GUIMAP_MAP) {
-            int key = read_keyboard_press(gapp.kbd_fds, gapp.num_kbd_fds);
+            int key = guimap_read_key(&gapp);
             if (key > 0) {
-                g_map[gapp.cur_map].keycode = key;
+                gapp.dirty = 1;
+                gapp.map[gapp.cur_map].keycode = key;
                 gapp.mapped[gapp.cur_map] = 1;
 
-                drain_keyboard_events(gapp.kbd_fds, gapp.num_kbd_fds);
-                usleep(DEBOUNCE_MS * 1000);
-                drain_keyboard_events(gapp.kbd_fds, gapp.num_kbd_fds);
+                guimap_drain(&gapp);
+                gapp.debounce_until = now + DEBOUNCE_MS;
 
                 if (gapp.redo_single >= 0) {
                     gapp.redo_single = -1;
@@ -1669,11 +5381,13 @@ static int guimap_run(void)
             }
         }
         else if (gapp.state == GUIMAP_REVIEW) {
-            int key = read_keyboard_press(gapp.kbd_fds, gapp.num_kbd_fds);
+            int key = guimap_read_key(&gapp);
             int jdy = 0, jconfirm = 0;
             if (gapp.joy_fd >= 0)
                 read_joystick_nav(gapp.joy_fd, &gapp.joy_prev_y,
                                   &jdy, &jconfirm);
+            if (key > 0 || jdy || jconfirm)
+                gapp.dirty = 1;
 
             if (key == KEY_UP || jdy < 0) {
                 gapp.review_sel--;
@@ -1691,7 +5405,7 @@ static int guimap_run(void)
                     gapp.redo_single = gapp.review_sel;
                     gapp.cur_map = gapp.review_sel;
                     gapp.state = GUIMAP_MAP;
-                    drain_keyboard_events(gapp.kbd_fds, gapp.num_kbd_fds);
+                    guimap_drain(&gapp);
                 }
             }
             else if (key == KEY_A) {
@@ -1707,7 +5421,7 @@ static int guimap_run(void)
                 /* save to file */
                 browser_load(&gapp.browser, "/mnt");
                 gapp.state = GUIMAP_BROWSE;
-                drain_keyboard_events(gapp.kbd_fds, gapp.num_kbd_fds);
+                guimap_drain(&gapp);
             }
             else if (key == KEY_ENTER || key == KEY_SPACE || jconfirm) {
                 if (gapp.review_sel >= 0 &&
@@ -1715,7 +5429,7 @@ static int guimap_run(void)
                     gapp.redo_single = gapp.review_sel;
                     gapp.cur_map = gapp.review_sel;
                     gapp.state = GUIMAP_MAP;
-                    drain_keyboard_events(gapp.kbd_fds, gapp.num_kbd_fds);
+                    guimap_drain(&gapp);
                 }
                 else if (gapp.review_sel == GUIMAP_REVIEW_APPLY) {
                     gapp.applied = 1;
@@ -1727,17 +5441,21 @@ static int guimap_run(void)
                 else if (gapp.review_sel == GUIMAP_REVIEW_SAVE) {
                     browser_load(&gapp.browser, "/mnt");
                     gapp.state = GUIMAP_BROWSE;
-                    drain_keyboard_events(gapp.kbd_fds, gapp.num_kbd_fds);
+                    guimap_drain(&gapp);
                 }
             }
         }
         else if (gapp.state == GUIMAP_BROWSE) {
             DirBrowser *b = &gapp.browser;
-            int key = read_keyboard_press(gapp.kbd_fds, gapp.num_kbd_fds);
+            if (browser_step(b))
+                gapp.dirty = 1;
+            int key = guimap_read_key(&gapp);
             int jdy = 0, jconfirm = 0;
             if (gapp.joy_fd >= 0)
                 read_joystick_nav(gapp.joy_fd, &gapp.joy_prev_y,
                                   &jdy, &jconfirm);
+            if (key > 0 || jdy || jconfirm)
+                gapp.dirty = 1;
 
             if (key == KEY_UP || jdy < 0) {
                 b->selected--;
@@ -1745,32 +5463,31 @@ static int guimap_run(void)
             }
             else if (key == KEY_DOWN || jdy > 0) {
                 b->selected++;
-                if (b->selected >= b->count) b->selected = b->count - 1;
+                if (b->selected >= browser_count(b))
+                    b->selected = browser_count(b) - 1;
             }
             else if (key == KEY_ENTER || jconfirm) {
-                if (b->count > 0) {
-                    DirEntry *e = &b->entries[b->selected];
-                    if (strcmp(e->name, "..") == 0) {
-                        char *slash = strrchr(b->path, '/');
-                        if (slash && slash != b->path) *slash = '\0';
-                        else strcpy(b->path, "/");
-                        browser_load(b, b->path);
-                    } else if (e->is_dir) {
-                        char newpath[MAX_PATH_LEN];
-                        if (strcmp(b->path, "/") == 0)
-                            snprintf(newpath, sizeof(newpath),
-                                     "/%.250s", e->name);
-                        else
-                            snprintf(newpath, sizeof(newpath),
-                                     "%.250s/%.250s", b->path, e->name);
-                        browser_load(b, newpath);
-                    } else {
-                        /* Export here */
-                        guimap_save_script(&gapp);
-                        gapp.state = GUIMAP_REVIEW;
-                        drain_keyboard_events(gapp.kbd_fds,
-                                              gapp.num_kbd_fds);
-                    }
+                int is_dir;
+                const char *name = browser_entry(b, b->selected, &is_dir);
+                if (is_dir && strcmp(name, "..") == 0) {
+                    char *slash = strrchr(b->path, '/');
+                    if (slash && slash != b->path) *slash = '\0';
+                    else strcpy(b->path, "/");
+                    browser_load(b, b->path);
+                } else if (is_dir) {
+                    char newpath[MAX_PATH_LEN];
+                    if (strcmp(b->path, "/") == 0)
+                        snprintf(newpath, sizeof(newpath),
+                                 "/%.250s", name);
+                    else
+                        snprintf(newpath, sizeof(newpath),
+                                 "%.250s/%.250s", b->path, name);
+                    browser_load(b, newpath);
+                } else {
+                    /* Export here */
+                    guimap_save_script(&gapp);
+                    gapp.state = GUIMAP_REVIEW;
+                    guimap_drain(&gapp);
                 }
             }
             else if (key == KEY_LEFT || key == KEY_BACKSPACE) {
@@ -1793,17 +5510,24 @@ static int guimap_run(void)
             }
         }
 
-        /* Render */
-        fb_clear(&gapp.fb, COL_BG);
+render:
+        /* Render only what changed; frames with no damage skip the flip */
+        if (gapp.dirty) {
+            fb_clear(&gapp.fb, COL_BG);
 
-        switch (gapp.state) {
-        case GUIMAP_MAP:    guimap_render_map(&gapp);    break;
-        case GUIMAP_REVIEW: guimap_render_review(&gapp); break;
-        case GUIMAP_BROWSE: guimap_render_browse(&gapp); break;
+            switch (gapp.state) {
+            case GUIMAP_MAP:    guimap_render_map(&gapp);    break;
+            case GUIMAP_REVIEW: guimap_render_review(&gapp); break;
+            case GUIMAP_BROWSE: guimap_render_browse(&gapp); break;
+            }
+        } else if (gapp.blink_dirty && gapp.state == GUIMAP_MAP) {
+            guimap_render_map_blink(&gapp);
         }
+        gapp.dirty = 0;
+        gapp.blink_dirty = 0;
 
         fb_flip(&gapp.fb);
-        usleep(FRAME_MS * 1000);
+        guimap_wait(&gapp, waitp);
     }
 
     /* Restore framebuffer to black */
@@ -1814,30 +5538,118 @@ static int guimap_run(void)
         close(gapp.joy_fd);
     for (int i = 0; i < gapp.num_kbd_fds; i++)
         close(gapp.kbd_fds[i]);
+    joy_art_free(&gapp.joy);
+    browser_free(&gapp.browser);
     fb_destroy(&gapp.fb);
+    if (!remote)
+        sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+    if (gapp.quit)
+        return -1;
     return gapp.applied ? 0 : 1;
 }
 
+/* The main thread in normal mode: wait for the translation thread to
+ * start a remap, run the GUI on its snapshot of the mappings and send
+ * the result back, until it quits */
+static void gui_serve(void)
+{
+    struct pollfd pfd = { .fd = g_gui_efd, .events = POLLIN };
+    GuiMsg m;
+
+    for (;;) {
+        while (gui_recv(&m)) {
+            if (m.kind == GUI_MSG_QUIT)
+                return;
+            if (m.kind != GUI_MSG_REMAP)
+                continue;   /* a key press left over from the last remap */
+
+            /* Stopping the64 frees the framebuffer; waiting for that
+             * here keeps it off the translation thread */
+            the64_stop();
+            int res = guimap_run(m.arg, g_remap_maps, 1);
+            if (res < 0)
+                return;
+            int i = spsc_push_slot(&g_to_tr, TR_SLOTS);
+            if (i < 0) continue;
+            TrMsg *r = &g_to_tr_msg[i];
+            r->player  = m.arg;
+            r->applied = res == 0;
+            memcpy(r->map, g_remap_maps[m.arg], sizeof(r->map));
+            spsc_push_done(&g_to_tr);
+            efd_wake(g_tr_efd);
+        }
+        if (poll(&pfd, 1, -1) > 0)
+            efd_ack(g_gui_efd);
+    }
+}
+
+#else /* K2J_NO_GUIMAP */
+
+/* Translation-only build: nothing to serve, wait for the translation
+ * thread to quit */
+static void gui_serve(void)
+{
+    struct pollfd pfd = { .fd = g_gui_efd, .events = POLLIN };
+    GuiMsg m;
+
+    for (;;) {
+        while (gui_recv(&m))
+            if (m.kind == GUI_MSG_QUIT)
+                return;
+        if (poll(&pfd, 1, -1) > 0)
+            efd_ack(g_gui_efd);
+    }
+}
+
+#endif /* K2J_NO_GUIMAP */
+
 /* ================================================================
  * main
  * ================================================================ */
 
 int main(int argc, char **argv)
 {
-    int help = 0, guimap = 0;
+    int help = 0, guimap = 0, list_profiles = 0;
 
     init_mappings();
 
-    if (parse_args(argc, argv, &help, &guimap) < 0)
+    if (parse_args(argc, argv, &help, &guimap, &list_profiles) < 0)
         return 1;
 
+    /* Saves the player the options were last scoped to by --player */
+    if (g_save_profile && !help)
+        return profile_save(g_profiles_path, g_save_profile) < 0 ? 1 : 0;
+    g_player = &g_players[0];
+
     if (help) {
         print_usage();
         return 0;
     }
 
-    if (guimap)
-        return guimap_run();
+    if (list_profiles) {
+        if (!g_profiles_map && profiles_load(g_profiles_path) < 0)
+            return 1;
+        profiles_list();
+        return 0;
+    }
+
+    if (g_show_stats)
+        return stats_show();
+
+    if (g_bench_path)
+        return bench_run(g_bench_path, g_bench_loops);
+
+    if (guimap) {
+#ifdef K2J_NO_GUIMAP
+        fprintf(stderr, "Error: this build has no --guimap (K2J_NO_GUIMAP)\n");
+        return 1;
+#else
+        Mapping maps[MAX_PLAYERS][NUM_MAPPINGS];
+        for (int p = 0; p < g_num_players; p++)
+            memcpy(maps[p], g_players[p].map, sizeof(maps[p]));
+        return guimap_run(0, maps, 0);
+#endif
+    }
 
     return normal_run();
 }